@@ -0,0 +1,253 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <pthread.h>
+#include <string.h>
+
+#include "catalog.h"
+#include "includes/dictionary.h"
+#include "includes/set.h"
+
+static pthread_mutex_t lock;
+static set* files; // Files stored in Pi-Share on this server
+static dictionary* file_to_server; // Maps file name -> server_info*
+static vector* mini_servers; // List of all sub-servers for round-robin PUT
+static dictionary* writers; // Maps file name -> number of PUTs currently writing it
+static unsigned long version; // Bumped by every change to files, file_to_server or mini_servers
+
+void* server_info_copy_constructor(void* p) {
+    server_info* copy = malloc(sizeof(server_info));
+    strcpy(copy->ip, ((server_info*)p)->ip);
+    strcpy(copy->port, ((server_info*)p)->port);
+    return copy;
+}
+
+void* server_info_default_constructor() {
+    return calloc(1, sizeof(server_info));
+}
+
+bool server_info_equals(const server_info* a, const server_info* b) {
+    return strcmp(a->ip, b->ip) == 0 && strcmp(a->port, b->port) == 0;
+}
+
+void catalog_init(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    files = string_set_create();
+    file_to_server = dictionary_create(string_hash_function, string_compare, string_copy_constructor, free,
+                                       server_info_copy_constructor, free);
+    mini_servers = vector_create(server_info_copy_constructor, free, server_info_default_constructor);
+    writers = string_to_int_dictionary_create();
+}
+
+void catalog_destroy(void) {
+    set_destroy(files);
+    dictionary_destroy(file_to_server);
+    vector_destroy(mini_servers);
+    dictionary_destroy(writers);
+    pthread_mutex_destroy(&lock);
+}
+
+void catalog_lock(void) {
+    pthread_mutex_lock(&lock);
+}
+
+void catalog_unlock(void) {
+    pthread_mutex_unlock(&lock);
+}
+
+bool catalog_has_local(const char* name) {
+    catalog_lock();
+    const bool found = set_contains(files, (void*)name);
+    catalog_unlock();
+    return found;
+}
+
+void catalog_add_local(const char* name) {
+    catalog_lock();
+    set_add(files, (void*)name);
+    ++version;
+    catalog_unlock();
+}
+
+void catalog_add_local_many(vector* names) {
+    catalog_lock();
+    for (size_t i = 0; i < vector_size(names); ++i) {
+        set_add(files, vector_get(names, i));
+    }
+    ++version;
+    catalog_unlock();
+}
+
+bool catalog_remove_local(const char* name) {
+    catalog_lock();
+    const bool found = set_contains(files, (void*)name);
+    if (found) {
+        set_remove(files, (void*)name);
+        ++version;
+    }
+    catalog_unlock();
+    return found;
+}
+
+size_t catalog_local_count(void) {
+    catalog_lock();
+    const size_t count = set_cardinality(files);
+    catalog_unlock();
+    return count;
+}
+
+vector* catalog_local_files(void) {
+    vector* copy = string_vector_create();
+    catalog_lock();
+    vector_reserve(copy, set_cardinality(files));
+    SET_FOR_EACH(files, f, vector_push_back(copy, f););
+    catalog_unlock();
+    return copy;
+}
+
+void catalog_begin_write(const char* name) {
+    catalog_lock();
+    int count = 1;
+    if (dictionary_contains(writers, (void*)name)) {
+        count += *(int*)dictionary_get(writers, (void*)name);
+    }
+    dictionary_set(writers, (void*)name, &count);
+    catalog_unlock();
+}
+
+void catalog_end_write(const char* name) {
+    catalog_lock();
+    if (dictionary_contains(writers, (void*)name)) {
+        const int count = *(int*)dictionary_get(writers, (void*)name) - 1;
+        if (count <= 0) {
+            dictionary_remove(writers, (void*)name);
+        } else {
+            dictionary_set(writers, (void*)name, (void*)&count);
+        }
+    }
+    catalog_unlock();
+}
+
+bool catalog_is_being_written(const char* name) {
+    catalog_lock();
+    const bool writing = dictionary_contains(writers, (void*)name);
+    catalog_unlock();
+    return writing;
+}
+
+bool catalog_lookup_remote(const char* name, server_info* out) {
+    catalog_lock();
+    const bool found = dictionary_contains(file_to_server, (void*)name);
+    if (found && out != NULL) {
+        *out = *(server_info*)dictionary_get(file_to_server, (void*)name);
+    }
+    catalog_unlock();
+    return found;
+}
+
+void catalog_set_remote(const char* name, const server_info* server) {
+    catalog_lock();
+    dictionary_set(file_to_server, (void*)name, (void*)server);
+    ++version;
+    catalog_unlock();
+}
+
+void catalog_set_remote_many(vector* names, const server_info* server) {
+    catalog_lock();
+    for (size_t i = 0; i < vector_size(names); ++i) {
+        dictionary_set(file_to_server, vector_get(names, i), (void*)server);
+    }
+    ++version;
+    catalog_unlock();
+}
+
+bool catalog_remove_remote(const char* name) {
+    catalog_lock();
+    const bool found = dictionary_contains(file_to_server, (void*)name);
+    if (found) {
+        dictionary_remove(file_to_server, (void*)name);
+        ++version;
+    }
+    catalog_unlock();
+    return found;
+}
+
+size_t catalog_remote_count(void) {
+    catalog_lock();
+    const size_t count = dictionary_size(file_to_server);
+    catalog_unlock();
+    return count;
+}
+
+vector* catalog_remote_files(void) {
+    vector* copy = string_vector_create();
+    catalog_lock();
+    vector* keys = dictionary_keys(file_to_server);
+    VECTOR_FOR_EACH(keys, f, vector_push_back(copy, f););
+    vector_destroy(keys);
+    catalog_unlock();
+    return copy;
+}
+
+vector* catalog_files_on(const server_info* server) {
+    vector* copy = string_vector_create();
+    catalog_lock();
+    vector* keys = dictionary_keys(file_to_server);
+    VECTOR_FOR_EACH(
+        keys, f,
+        if (server_info_equals(dictionary_get(file_to_server, f), server)) {
+        vector_push_back(copy, f);
+        }
+    );
+    vector_destroy(keys);
+    catalog_unlock();
+    return copy;
+}
+
+bool catalog_add_server(const server_info* server) {
+    catalog_lock();
+    bool known = false;
+    VECTOR_FOR_EACH(
+        mini_servers, s,
+        if (server_info_equals(s, server)) {
+        known = true;
+        break;
+        }
+    );
+    if (!known) {
+        vector_push_back(mini_servers, (void*)server);
+        ++version;
+    }
+    catalog_unlock();
+    return !known;
+}
+
+size_t catalog_server_count(void) {
+    catalog_lock();
+    const size_t count = vector_size(mini_servers);
+    catalog_unlock();
+    return count;
+}
+
+bool catalog_get_server(const size_t index, server_info* out) {
+    catalog_lock();
+    const bool found = index < vector_size(mini_servers);
+    if (found) {
+        *out = *(server_info*)vector_get(mini_servers, index);
+    }
+    catalog_unlock();
+    return found;
+}
+
+unsigned long catalog_version(void) {
+    catalog_lock();
+    const unsigned long current = version;
+    catalog_unlock();
+    return current;
+}
@@ -0,0 +1,68 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "includes/vector.h"
+
+typedef struct {
+    char ip[INET_ADDRSTRLEN]; // IPv4 address
+    char port[6]; // Port as string (max 65535 + null)
+} server_info;
+
+void* server_info_copy_constructor(void* p);
+void* server_info_default_constructor(void);
+
+/**
+ * The catalog is everything the server knows about where files live:
+ * the files stored locally, the files stored on sub-servers, and the list of sub-servers.
+ * Every function below takes the catalog lock itself, so they can be called from any thread.
+ * Use catalog_lock()/catalog_unlock() around a sequence of calls that has to be atomic (the lock is recursive).
+ */
+void catalog_init(void);
+void catalog_destroy(void);
+void catalog_lock(void);
+void catalog_unlock(void);
+// Changes whenever a file or sub-server is added or removed, to tell if anything happened since an earlier call
+unsigned long catalog_version(void);
+
+/* Files stored on this server */
+bool catalog_has_local(const char* name);
+void catalog_add_local(const char* name);
+// Same as catalog_add_local for every name in `names`, taking the lock once
+void catalog_add_local_many(vector* names);
+bool catalog_remove_local(const char* name);
+size_t catalog_local_count(void);
+// Returns a copy of the local file names, the caller has to vector_destroy it
+vector* catalog_local_files(void);
+
+/*
+ * PUTs in progress on this server. A file that is being written must not be moved somewhere else,
+ * since the data that is still arriving would be lost.
+ */
+void catalog_begin_write(const char* name);
+void catalog_end_write(const char* name);
+bool catalog_is_being_written(const char* name);
+
+/* Files stored on sub-servers */
+bool catalog_lookup_remote(const char* name, server_info* out);
+void catalog_set_remote(const char* name, const server_info* server);
+// Same as catalog_set_remote for every name in `names`, taking the lock once
+void catalog_set_remote_many(vector* names, const server_info* server);
+bool catalog_remove_remote(const char* name);
+size_t catalog_remote_count(void);
+// Returns a copy of the names of the files stored on sub-servers, the caller has to vector_destroy it
+vector* catalog_remote_files(void);
+// Returns a copy of the names of the files stored on `server`, the caller has to vector_destroy it
+vector* catalog_files_on(const server_info* server);
+
+/* Sub-servers */
+// Returns false if `server` was already known
+bool catalog_add_server(const server_info* server);
+size_t catalog_server_count(void);
+bool catalog_get_server(size_t index, server_info* out);
+bool server_info_equals(const server_info* a, const server_info* b);
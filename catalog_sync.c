@@ -0,0 +1,428 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "catalog_sync.h"
+#include "common.h"
+#include "peer.h"
+#include "pullcache.h"
+#include "includes/dictionary.h"
+#include "includes/set.h"
+
+#define SYNC_LOG_SIZE 4096 // Events kept around for replaying after a reconnect
+#define SYNC_BATCH_BYTES (64 * 1024) // Target payload size of a snapshot batch
+#define SYNC_HEARTBEAT_INTERVAL 5 // Seconds of silence before we send a heartbeat
+#define SYNC_MAX_BACKOFF 30 // Seconds
+
+typedef struct {
+    char type;
+    uint64_t seq;
+    char* name;
+} sync_event;
+
+/* Sub-server side */
+static bool syncing = false;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static sync_event event_log[SYNC_LOG_SIZE]; // Ring buffer indexed by seq % SYNC_LOG_SIZE
+static uint64_t next_seq = 1;
+static char* main_host;
+static char* main_port;
+static char* listen_port;
+static char* advertise_ip;
+
+/* Main server side */
+typedef struct {
+    uint64_t epoch;
+    uint64_t acked;
+} sync_progress;
+
+struct sync_session {
+    server_info server;
+    char key[32]; // "<ip>:<port>", key into progress
+    uint64_t epoch;
+    set* snapshot; // Names seen since the last SYNC_BEGIN, NULL outside of a snapshot
+    char* buffer; // Bytes of an incomplete frame
+    size_t buffer_len;
+    size_t buffer_cap;
+};
+
+static dictionary* progress; // Maps "<ip>:<port>" -> sync_progress*, survives reconnects
+
+static size_t put_varint(char* out, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (char)value;
+    return len;
+}
+
+/**
+ * @return the number of bytes used by the varint at `in`, or 0 if it runs past `end`
+ */
+static size_t get_varint(const char* in, const char* end, uint64_t* value) {
+    *value = 0;
+    for (size_t i = 0; in + i < end && i < 10; ++i) {
+        *value |= (uint64_t)(in[i] & 0x7f) << (7 * i);
+        if (!(in[i] & 0x80)) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static bool send_frame(const int sock, const char type, const uint64_t seq, const char* payload, const uint32_t len) {
+    char header[SYNC_FRAME_HEADER_SIZE];
+    header[0] = type;
+    memcpy(header + 1, &seq, sizeof(seq));
+    memcpy(header + 1 + sizeof(seq), &len, sizeof(len));
+    return peer_write_all(sock, header, sizeof(header)) && (len == 0 || peer_write_all(sock, payload, len));
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/**
+ * @brief Sends every local file name to the main server, sorted and front-coded in batches.
+ * @param sent receives the sequence number the snapshot is current to
+ */
+static bool send_snapshot(const int sock, uint64_t* sent) {
+    /*
+     * Read the sequence number before copying the catalog: every event up to it has already changed the catalog,
+     * and events after it are replayed on top of the snapshot, which is harmless since applying them is idempotent.
+     */
+    pthread_mutex_lock(&log_lock);
+    const uint64_t snapshot_seq = next_seq - 1;
+    pthread_mutex_unlock(&log_lock);
+
+    vector* names = catalog_local_files();
+    qsort(vector_begin(names), vector_size(names), sizeof(void*), compare_names);
+
+    bool ok = send_frame(sock, SYNC_BEGIN, snapshot_seq, NULL, 0);
+    char* entries = malloc(SYNC_BATCH_BYTES + 1024 + 20); // One name past the target always fits
+    char* payload = malloc(SYNC_BATCH_BYTES + 1024 + 30);
+    const char* prev = "";
+    size_t i = 0;
+    while (ok && i < vector_size(names)) {
+        size_t count = 0;
+        size_t len = 0;
+        for (; i < vector_size(names) && len < SYNC_BATCH_BYTES; ++i, ++count) {
+            const char* name = vector_get(names, i);
+            size_t shared = 0;
+            while (prev[shared] != '\0' && prev[shared] == name[shared]) {
+                ++shared;
+            }
+            const size_t suffix = strlen(name + shared);
+            len += put_varint(entries + len, shared);
+            len += put_varint(entries + len, suffix);
+            memcpy(entries + len, name + shared, suffix);
+            len += suffix;
+            prev = name;
+        }
+        /* The count goes in front of the entries, and we only know it once the batch is full */
+        const size_t header_len = put_varint(payload, count);
+        memcpy(payload + header_len, entries, len);
+        ok = send_frame(sock, SYNC_BATCH, snapshot_seq, payload, (uint32_t)(header_len + len));
+    }
+    free(entries);
+    free(payload);
+    ok = ok && send_frame(sock, SYNC_END, snapshot_seq, NULL, 0);
+    vector_destroy(names);
+    *sent = snapshot_seq;
+    return ok;
+}
+
+/**
+ * @brief Connects to the main server and performs the SYNC handshake.
+ * @param acked receives the last sequence number the main server has applied
+ * @return the connected socket, or -1
+ */
+static int sync_connect(const uint64_t epoch, uint64_t* acked) {
+    const int sock = peer_connect_host(main_host, main_port);
+    if (sock == -1) {
+        return -1;
+    }
+    char ip[INET_ADDRSTRLEN];
+    if (advertise_ip != NULL) {
+        snprintf(ip, sizeof(ip), "%s", advertise_ip);
+    } else { /* Advertise the address the main server sees us at */
+        struct sockaddr_in local;
+        socklen_t len = sizeof(local);
+        getsockname(sock, (struct sockaddr*)&local, &len);
+        inet_ntop(AF_INET, &local.sin_addr, ip, sizeof(ip));
+    }
+    char* header_msg;
+    asprintf(&header_msg, "SYNC %s %s %llu\n", ip, listen_port, (unsigned long long)epoch);
+    char ok[3];
+    const bool handshake = peer_write_all(sock, header_msg, strlen(header_msg)) &&
+                           peer_read_all(sock, ok, sizeof(ok)) && strncmp(ok, "OK\n", sizeof(ok)) == 0 &&
+                           peer_read_all(sock, acked, sizeof(*acked));
+    free(header_msg);
+    if (!handshake) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static void* sync_worker(void* arg) {
+    (void)arg;
+    uint64_t epoch;
+    if (getrandom(&epoch, sizeof(epoch), 0) != sizeof(epoch)) {
+        epoch = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+    }
+    unsigned backoff = 1;
+    while (true) {
+        uint64_t sent;
+        const int sock = sync_connect(epoch, &sent);
+        if (sock == -1) {
+            sleep(backoff);
+            backoff = backoff * 2 > SYNC_MAX_BACKOFF ? SYNC_MAX_BACKOFF : backoff * 2;
+            continue;
+        }
+        backoff = 1;
+        LOG("sync: connected to main server %s:%s", main_host, main_port);
+
+        bool ok = true;
+        pthread_mutex_lock(&log_lock);
+        const uint64_t oldest = next_seq > SYNC_LOG_SIZE ? next_seq - SYNC_LOG_SIZE : 1;
+        const bool can_replay = sent > 0 && sent + 1 >= oldest && sent < next_seq;
+        pthread_mutex_unlock(&log_lock);
+        if (!can_replay) {
+            ok = send_snapshot(sock, &sent);
+        }
+        while (ok) {
+            pthread_mutex_lock(&log_lock);
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += SYNC_HEARTBEAT_INTERVAL;
+            int wait = 0;
+            while (sent + 1 == next_seq && wait != ETIMEDOUT) {
+                wait = pthread_cond_timedwait(&log_cond, &log_lock, &deadline);
+            }
+            if (sent + 1 == next_seq) {
+                pthread_mutex_unlock(&log_lock);
+                ok = send_frame(sock, SYNC_HEARTBEAT, sent, NULL, 0);
+                continue;
+            }
+            if (sent + SYNC_LOG_SIZE < next_seq) {
+                /* We fell so far behind that the log wrapped around, start over from a snapshot */
+                pthread_mutex_unlock(&log_lock);
+                ok = send_snapshot(sock, &sent);
+                continue;
+            }
+            const sync_event* e = &event_log[(sent + 1) % SYNC_LOG_SIZE];
+            const char type = e->type;
+            char* name = strdup(e->name);
+            pthread_mutex_unlock(&log_lock);
+            ok = send_frame(sock, type, sent + 1, name, (uint32_t)strlen(name));
+            free(name);
+            if (ok) {
+                ++sent;
+            }
+        }
+        LOG("sync: lost connection to main server %s:%s", main_host, main_port);
+        close(sock);
+    }
+    return NULL;
+}
+
+void catalog_sync_start(const char* host, const char* port, const char* our_port, const char* our_ip) {
+    main_host = strdup(host);
+    main_port = strdup(port);
+    listen_port = strdup(our_port);
+    advertise_ip = our_ip != NULL ? strdup(our_ip) : NULL;
+    syncing = true;
+
+    if (!spawn_detached(sync_worker, NULL)) {
+        exit(1);
+    }
+}
+
+void catalog_sync_record(const sync_event_type type, const char* name) {
+    if (!syncing) {
+        return;
+    }
+    pthread_mutex_lock(&log_lock);
+    sync_event* e = &event_log[next_seq % SYNC_LOG_SIZE];
+    free(e->name);
+    e->type = (char)type;
+    e->seq = next_seq++;
+    e->name = strdup(name);
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_lock);
+}
+
+sync_session* sync_session_create(const server_info* server, const uint64_t epoch) {
+    if (progress == NULL) {
+        progress = string_to_shallow_dictionary_create();
+    }
+    sync_session* session = calloc(1, sizeof(sync_session));
+    session->server = *server;
+    session->epoch = epoch;
+    snprintf(session->key, sizeof(session->key), "%s:%s", server->ip, server->port);
+    sync_progress* p = dictionary_contains(progress, session->key) ? dictionary_get(progress, session->key) : NULL;
+    if (p == NULL) {
+        p = calloc(1, sizeof(sync_progress));
+        dictionary_set(progress, session->key, p);
+    }
+    if (p->epoch != epoch) { /* The sub-server restarted, none of its old sequence numbers mean anything */
+        p->epoch = epoch;
+        p->acked = 0;
+    }
+    return session;
+}
+
+uint64_t sync_session_acked(const sync_session* session) {
+    return ((sync_progress*)dictionary_get(progress, (void*)session->key))->acked;
+}
+
+/**
+ * @brief Decodes a SYNC_BATCH payload and points every name in it at this sub-server.
+ */
+static bool apply_batch(sync_session* session, const char* payload, const uint32_t len) {
+    const char* end = payload + len;
+    uint64_t count;
+    size_t used = get_varint(payload, end, &count);
+    if (used == 0 || session->snapshot == NULL) {
+        return false;
+    }
+    payload += used;
+    char name[1024] = {0};
+    catalog_lock();
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t shared, suffix;
+        if ((used = get_varint(payload, end, &shared)) == 0) break;
+        payload += used;
+        if ((used = get_varint(payload, end, &suffix)) == 0) break;
+        payload += used;
+        if (shared + suffix >= sizeof(name) || shared > strlen(name) || payload + suffix > end) {
+            catalog_unlock();
+            return false;
+        }
+        memcpy(name + shared, payload, suffix);
+        name[shared + suffix] = '\0';
+        payload += suffix;
+        catalog_set_remote(name, &session->server);
+        set_add(session->snapshot, name);
+    }
+    catalog_unlock();
+    return payload == end;
+}
+
+static bool apply_frame(sync_session* session, const char type, const uint64_t seq, const char* payload,
+                        const uint32_t len) {
+    sync_progress* p = dictionary_get(progress, session->key);
+    char name[1024];
+    switch (type) {
+    case SYNC_BEGIN:
+        if (session->snapshot != NULL) {
+            set_destroy(session->snapshot);
+        }
+        session->snapshot = string_set_create();
+        /* Files may have changed while we were not listening */
+        pullcache_forget_server(&session->server);
+        return true;
+    case SYNC_BATCH:
+        return apply_batch(session, payload, len);
+    case SYNC_END: {
+        if (session->snapshot == NULL) {
+            return false;
+        }
+        /* Whatever we thought this sub-server had, but it didn't list, is gone */
+        vector* known = catalog_files_on(&session->server);
+        VECTOR_FOR_EACH(
+            known, f,
+            if (!set_contains(session->snapshot, f)) {
+            catalog_remove_remote(f);
+            }
+        );
+        vector_destroy(known);
+        set_destroy(session->snapshot);
+        session->snapshot = NULL;
+        p->acked = seq;
+        return true;
+    }
+    case SYNC_ADD:
+    case SYNC_UPDATE:
+    case SYNC_REMOVE:
+        if (len == 0 || len >= sizeof(name)) {
+            return false;
+        }
+        if (seq <= p->acked) { /* Already covered by a snapshot or an earlier connection */
+            return true;
+        }
+        memcpy(name, payload, len);
+        name[len] = '\0';
+        pullcache_invalidate(name);
+        if (type == SYNC_REMOVE) {
+            server_info current;
+            catalog_lock();
+            if (catalog_lookup_remote(name, &current) && server_info_equals(&current, &session->server)) {
+                catalog_remove_remote(name);
+            }
+            catalog_unlock();
+        } else {
+            catalog_set_remote(name, &session->server);
+        }
+        p->acked = seq;
+        return true;
+    case SYNC_HEARTBEAT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool sync_session_feed(sync_session* session, const char* data, const size_t len) {
+    if (session->buffer_len + len > session->buffer_cap) {
+        session->buffer_cap = session->buffer_len + len > 2 * session->buffer_cap
+                                  ? session->buffer_len + len
+                                  : 2 * session->buffer_cap;
+        session->buffer = realloc(session->buffer, session->buffer_cap);
+    }
+    memcpy(session->buffer + session->buffer_len, data, len);
+    session->buffer_len += len;
+
+    size_t pos = 0;
+    while (session->buffer_len - pos >= SYNC_FRAME_HEADER_SIZE) {
+        const char* frame = session->buffer + pos;
+        uint64_t seq;
+        uint32_t payload_len;
+        memcpy(&seq, frame + 1, sizeof(seq));
+        memcpy(&payload_len, frame + 1 + sizeof(seq), sizeof(payload_len));
+        if (payload_len > SYNC_MAX_PAYLOAD) {
+            return false;
+        }
+        if (session->buffer_len - pos < SYNC_FRAME_HEADER_SIZE + payload_len) {
+            break;
+        }
+        if (!apply_frame(session, frame[0], seq, frame + SYNC_FRAME_HEADER_SIZE, payload_len)) {
+            return false;
+        }
+        pos += SYNC_FRAME_HEADER_SIZE + payload_len;
+    }
+    memmove(session->buffer, session->buffer + pos, session->buffer_len - pos);
+    session->buffer_len -= pos;
+    return true;
+}
+
+void sync_session_destroy(sync_session* session) {
+    if (session->snapshot != NULL) {
+        set_destroy(session->snapshot);
+    }
+    free(session->buffer);
+    free(session);
+}
@@ -0,0 +1,73 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "catalog.h"
+
+/**
+ * Sub-servers keep the main server's view of their files up to date over a long-lived SYNC connection.
+ *
+ * Sub-server -> main:  SYNC <ip> <port> <epoch>\n
+ * Main -> sub-server:  OK\n<last applied sequence number:uint64>
+ * Sub-server -> main:  a stream of frames <type:char><seq:uint64><length:uint32><payload>
+ *
+ * Every change to a sub-server's files gets the next sequence number of its event log. `epoch` identifies one run of
+ * the sub-server, so after a reconnect it can replay only the events the main server missed. When that is not
+ * possible it sends a snapshot instead: a SYNC_BEGIN frame, SYNC_BATCH frames holding the sorted file names
+ * front-coded against each other, and a SYNC_END frame. Both carry the sequence number the snapshot is current to.
+ */
+typedef enum {
+    SYNC_ADD = 'A', // payload: file name
+    SYNC_UPDATE = 'U', // payload: file name of a file whose contents changed
+    SYNC_REMOVE = 'R', // payload: file name
+    SYNC_BEGIN = 'B', // no payload, starts a snapshot
+    SYNC_BATCH = 'S', // payload: <count:varint> then <shared prefix:varint><suffix length:varint><suffix> per name
+    SYNC_END = 'E', // no payload, files of this sub-server that were not in the snapshot are gone
+    SYNC_HEARTBEAT = 'H' // no payload, lets the sub-server notice a dead connection
+} sync_event_type;
+
+#define SYNC_FRAME_HEADER_SIZE (1 + sizeof(uint64_t) + sizeof(uint32_t))
+#define SYNC_MAX_PAYLOAD (1024 * 1024)
+
+/* Sub-server side */
+
+/**
+ * @brief Starts streaming this server's catalog to the main server at `main_host`:`main_port` on a background thread.
+ * @param listen_port the port this server accepts clients on
+ * @param advertise_ip the address clients should be redirected to, or NULL to use the address we reach the main
+ * server from
+ */
+void catalog_sync_start(const char* main_host, const char* main_port, const char* listen_port,
+                        const char* advertise_ip);
+
+/**
+ * @brief Appends a change of a local file to the event log. Does nothing unless catalog_sync_start was called.
+ */
+void catalog_sync_record(sync_event_type type, const char* name);
+
+/* Main server side */
+
+typedef struct sync_session sync_session;
+
+/**
+ * @brief Starts applying the frames of a sub-server's SYNC connection to the catalog.
+ */
+sync_session* sync_session_create(const server_info* server, uint64_t epoch);
+
+/**
+ * @return the last sequence number of this sub-server and epoch the catalog is current to, 0 if none
+ */
+uint64_t sync_session_acked(const sync_session* session);
+
+/**
+ * @brief Buffers `len` bytes read from the connection and applies every complete frame.
+ * @return false if the sub-server sent something malformed
+ */
+bool sync_session_feed(sync_session* session, const char* data, size_t len);
+
+void sync_session_destroy(sync_session* session);
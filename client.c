@@ -7,87 +7,135 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include "includes/vector.h"
 
 #include "common.h"
+#include "compress.h"
 #include "format.h"
+#include "location_cache.h"
+#include "sha256.h"
 
 char** parse_args(int argc, char** argv);
 verb check_args(char** args);
 size_t write_all_to_server(int sock, const void* data, size_t size);
+size_t send_all_to_server(int sock, const void* data, size_t size, int flags);
 size_t read_all_from_server(int sock, void* buffer, size_t size);
 ssize_t read_line_from_server(int sock, char* buffer, size_t size);
+int try_connect_to_server(const char* ip_addr, const char* port);
 int connect_to_server(int sock, char* ip_addr, char* port);
+int connect_for_file(char** args, bool* from_cache);
+bool read_response_header(int sock, bool report_errors);
 bool parse_header(int sock);
 size_t get_size(int sock);
 ssize_t check_for_extra_data(int sock);
-void get(int sock, char** args);
-void put(int sock, char** args);
+void get(int sock, char** args, bool from_cache);
+void put(int sock, char** args, bool from_cache);
+bool link_by_hash(int sock, const char* remote_file, int fd, size_t size);
+bool compression_enabled(void);
+size_t receive_compressed(int sock, int fd);
+bool send_compressed(int sock, int fd, size_t size);
 void delete(int sock, char** args);
 void list(int sock);
+void list_all(int sock);
 void get_my_ip_addr(char* ipaddr);
-void add_server(int sock);
+void add_server(int sock, char** args);
+
+// Times a request a busy server turned away is tried again (default 5), and the longest we wait in between
+#define RETRIES_ENV "PI_SHARE_RETRIES"
+#define DEFAULT_RETRIES 5
+#define MAX_BACKOFF_MS 30000
+// SO_SNDBUF and SO_RCVBUF of our connections, for links the kernel's autotuning does not fill; unset leaves it be
+#define SNDBUF_ENV "PI_SHARE_SNDBUF"
+#define RCVBUF_ENV "PI_SHARE_RCVBUF"
+// Contents of an uncompressed PUT read from the file and written to the server at once
+#define PUT_BUFFER_SIZE (64 * 1024)
+// Host of the address unix:<path>, which names the Unix domain socket of a server on this host
+#define LOCAL_HOST "unix"
+
+static unsigned busy_retry_after; // Milliseconds a busy server asked us to wait, 0 if it took the request
+static bool last_attempt = true; // Errors are only reported on the last attempt
+
+/**
+ * @brief Waits before trying a request again that a busy server turned away: at least as long as the server asked,
+ * plus a random share of that delay doubled for every attempt, so clients turned away together come back spread out.
+ */
+static void back_off(const unsigned attempt) {
+    unsigned long long spread = (unsigned long long)busy_retry_after << (attempt < 16 ? attempt : 16);
+    if (spread > MAX_BACKOFF_MS) {
+        spread = MAX_BACKOFF_MS;
+    }
+    const unsigned long long wait = busy_retry_after + (unsigned long long)rand() % (spread + 1);
+    const struct timespec ts = {wait / 1000, (wait % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+}
 
 int main(const int argc, char** argv) {
     char** args = parse_args(argc, argv);
     const verb action = check_args(args);
-    // If there is a valid action, we need to connect for all possible cases
-    struct addrinfo hints = {0}, *res;
-
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
+    const char* retries_setting = getenv(RETRIES_ENV);
+    const unsigned retries = retries_setting != NULL ? strtoul(retries_setting, NULL, 10) : DEFAULT_RETRIES;
+    srand(time(NULL) ^ getpid());
     // ReSharper disable once CppDFANullDereference
-    const int status = getaddrinfo(args[0], args[1], &hints, &res);
-    if (status != 0) {
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
-        exit(1);
-    }
-
-    const int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (sock == -1) {
-        perror("socket() failed");
-        freeaddrinfo(res);
-        exit(1);
-    }
+    if (action == GET || action == PUT) {
+        location_cache_load(args[0], args[1]);
+    }
+    for (unsigned attempt = 0;; ++attempt) {
+        busy_retry_after = 0;
+        last_attempt = attempt == retries;
+        // If there is a valid action, we need to connect for all possible cases
+        bool from_cache = false;
+        int sock;
+        if (action == GET || action == PUT) {
+            sock = connect_for_file(args, &from_cache);
+        } else {
+            sock = connect_to_server(-1, args[0], args[1]);
+        }
+        // Now we are connected to the server
 
-    if (connect(sock, res->ai_addr, res->ai_addrlen) == -1) {
-        perror("connect() failed");
-        close(sock);
-        freeaddrinfo(res);
-        exit(1);
-    }
-    freeaddrinfo(res);
-    // Now we are connected to the server
-
-    switch (action) {
-    case GET:
-        get(sock, args);
-        break;
-    case PUT:
-        put(sock, args);
-        break;
-    case DELETE:
-        delete(sock, args);
-        break;
-    case LIST:
-        list(sock);
-        break;
-    case ADD_SERVER:
-        add_server(sock);
-    case V_UNKNOWN:
-        break;
+        switch (action) {
+        case GET:
+            get(sock, args, from_cache);
+            break;
+        case PUT:
+            put(sock, args, from_cache);
+            break;
+        case DELETE:
+            delete(sock, args);
+            break;
+        case LIST:
+            list(sock);
+            break;
+        case LIST_ALL:
+            list_all(sock);
+            break;
+        case ADD_SERVER:
+            add_server(sock, args);
+        case LINK: /* Sent by put() */
+        case SYNC: /* Only spoken between servers */
+        case V_UNKNOWN:
+            break;
+        }
+        if (busy_retry_after == 0 || last_attempt) {
+            break;
+        }
+        back_off(attempt);
     }
+    location_cache_save();
     free(args);
 }
 
@@ -150,6 +198,10 @@ verb check_args(char** args) {
         return LIST;
     }
 
+    if (strcmp(command, "LIST_ALL") == 0) {
+        return LIST_ALL;
+    }
+
     if (strcmp(command, "GET") == 0) {
         if (args[3] != NULL && args[4] != NULL) {
             return GET;
@@ -190,9 +242,17 @@ verb check_args(char** args) {
  * @return true if write completes, false if write fails before size bytes are sent to server
  */
 size_t write_all_to_server(const int sock, const void* data, const size_t size) {
+    return send_all_to_server(sock, data, size, 0);
+}
+
+/**
+ * @brief Same as write_all_to_server, with the `flags` of send. MSG_MORE holds a header back until the contents that
+ * follow it are written, so they share packets.
+ */
+size_t send_all_to_server(const int sock, const void* data, const size_t size, const int flags) {
     size_t bytes_written = 0;
     while (bytes_written < size) {
-        const ssize_t cur_written = write(sock, data + bytes_written, size - bytes_written);
+        const ssize_t cur_written = send(sock, data + bytes_written, size - bytes_written, flags);
         if (cur_written == -1) {
             break;
         }
@@ -201,6 +261,17 @@ size_t write_all_to_server(const int sock, const void* data, const size_t size)
     return bytes_written;
 }
 
+/**
+ * @brief Sets the socket option `option` to the number in the environment variable `name`, if it is set.
+ */
+static void set_buffer_size(const int sock, const int option, const char* name) {
+    const char* setting = getenv(name);
+    const int size = setting != NULL ? atoi(setting) : 0;
+    if (size > 0 && setsockopt(sock, SOL_SOCKET, option, &size, sizeof(size)) == -1) {
+        perror("setsockopt() failed");
+    }
+}
+
 /**
  * @brief Reads a specified number of bytes from a server socket into a buffer.
  *
@@ -235,7 +306,41 @@ ssize_t read_line_from_server(int sock, char* buffer, size_t size) {
     return (ssize_t)idx;
 }
 
-int connect_to_server(int sock, char* ip_addr, char* port) {
+/**
+ * @brief Opens a connection to the Unix domain socket at `path` of a server on this host, which skips the TCP stack.
+ * @return the connected socket, or -1 if the server could not be reached
+ */
+static int try_connect_local(const char* path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Unix domain socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+        perror("socket() failed");
+        return -1;
+    }
+    set_buffer_size(sock, SO_SNDBUF, SNDBUF_ENV);
+    set_buffer_size(sock, SO_RCVBUF, RCVBUF_ENV);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect() failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Opens a TCP connection to `ip_addr`:`port`, or one to the Unix domain socket `port` if `ip_addr` is
+ * LOCAL_HOST.
+ * @return the connected socket, or -1 if the server could not be reached
+ */
+int try_connect_to_server(const char* ip_addr, const char* port) {
+    if (strcmp(ip_addr, LOCAL_HOST) == 0) {
+        return try_connect_local(port);
+    }
     struct addrinfo hints = {0}, *res;
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
@@ -243,26 +348,77 @@ int connect_to_server(int sock, char* ip_addr, char* port) {
     const int new_status = getaddrinfo(ip_addr, port, &hints, &res);
     if (new_status != 0) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(new_status));
-        exit(1);
+        return -1;
     }
 
-    sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    const int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
     if (sock == -1) {
         perror("socket() failed");
         freeaddrinfo(res);
-        exit(1);
+        return -1;
     }
 
+    /* Requests and headers are written in one piece, so Nagle would only delay them */
+    const int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    /* Before connecting, so the window scale is agreed on for the buffer sizes */
+    set_buffer_size(sock, SO_SNDBUF, SNDBUF_ENV);
+    set_buffer_size(sock, SO_RCVBUF, RCVBUF_ENV);
     if (connect(sock, res->ai_addr, res->ai_addrlen) == -1) {
         perror("connect() failed");
         close(sock);
         freeaddrinfo(res);
-        exit(1);
+        return -1;
     }
     freeaddrinfo(res);
     return sock;
 }
 
+int connect_to_server(int sock, char* ip_addr, char* port) {
+    sock = try_connect_to_server(ip_addr, port);
+    if (sock == -1) {
+        exit(1);
+    }
+    return sock;
+}
+
+/**
+ * @brief Connects to the server that should handle a GET/PUT of args[3].
+ * If the location cache knows which sub-server holds the file, we go there directly and skip the redirect
+ * round trip through the main server. Otherwise, or if the cached sub-server is unreachable, we connect to the main
+ * server.
+ * @param args list of arguments from parse_args
+ * @param from_cache set to true if the returned socket is connected to a cached sub-server
+ * @return the connected socket
+ */
+int connect_for_file(char** args, bool* from_cache) {
+    char ip_addr[64];
+    char port[64];
+    *from_cache = false;
+    if (location_cache_lookup(args[3], ip_addr, port, sizeof(ip_addr))) {
+        const int sock = try_connect_to_server(ip_addr, port);
+        if (sock != -1) {
+            *from_cache = true;
+            return sock;
+        }
+        location_cache_invalidate(args[3]);
+    }
+    return connect_to_server(-1, args[0], args[1]);
+}
+
+/**
+ * @brief Checks whether the error `message` of the server says it is too busy to take the request.
+ * @return true if so, after noting how long it asked us to wait in busy_retry_after
+ */
+static bool server_busy(const char* message) {
+    unsigned retry_after;
+    if (sscanf(message, err_busy, &retry_after) != 1) {
+        return false;
+    }
+    busy_retry_after = retry_after > 0 ? retry_after : 1;
+    return true;
+}
+
 /**
  * @brief Parses the server response header from the given socket.
  *
@@ -272,6 +428,14 @@ int connect_to_server(int sock, char* ip_addr, char* port) {
  * If the header indicates an error, it additionally reads and prints the complete error message.
  */
 bool parse_header(const int sock) {
+    return read_response_header(sock, true);
+}
+
+/**
+ * @brief Same as parse_header, but the server's error message is only printed if `report_errors` is set.
+ * Used when we talked to a cached sub-server and can still fall back to the main server.
+ */
+bool read_response_header(const int sock, bool report_errors) {
     char* header = malloc(max_server_response_header_size + 1); // need one extra byte for '\0'
     if (read_all_from_server(sock, header, min_server_response_header_size) != min_server_response_header_size) {
         free(header);
@@ -300,9 +464,14 @@ bool parse_header(const int sock) {
         }
         if (total_read == buffer_size) {
             header = realloc(header, buffer_size + 1);
-            header[buffer_size] = '\0';
         }
-        print_error_message(header);
+        header[total_read] = '\0';
+        if (server_busy(header + max_server_response_header_size)) {
+            report_errors = last_attempt; /* Tried again otherwise */
+        }
+        if (report_errors) {
+            print_error_message(header);
+        }
         free(header);
         return false;
     }
@@ -312,6 +481,68 @@ bool parse_header(const int sock) {
     return true;
 }
 
+/**
+ * @return whether `sock` is connected to the Unix domain socket of a server on this host
+ */
+static bool connected_locally(const int sock) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    return getsockname(sock, (struct sockaddr*)&addr, &addrlen) == 0 && addr.ss_family == AF_UNIX;
+}
+
+/**
+ * @brief Reads the encoding byte of an FGET response, along with the descriptor the server may have attached to it.
+ * @param fd set to that descriptor, -1 if none came along
+ * @return false if the connection closed
+ */
+static bool read_encoding_and_fd(const int sock, char* encoding, int* fd) {
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = {encoding, 1};
+    struct msghdr msg = {
+        .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)
+    };
+    *fd = -1;
+    if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        return false;
+    }
+    const struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return true;
+}
+
+/**
+ * @brief Copies the first `size` bytes of the file the server passed as `fd` into `local_fd`, and closes `fd`.
+ * copy_file_range lets the file system share the blocks (reflink) or copy them in the kernel; where it cannot be
+ * used, as across file systems or into something that is not a regular file, sendfile still copies in the kernel.
+ * @return the number of bytes copied
+ */
+static size_t copy_passed_file(const int fd, const int local_fd, const size_t size) {
+    off_t pos = 0;
+    bool ranges = true;
+    while ((size_t)pos < size) {
+        ssize_t copied = -1;
+        if (ranges) {
+            copied = copy_file_range(fd, &pos, local_fd, NULL, size - pos, 0);
+            if (copied == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                ranges = false;
+            }
+        }
+        if (!ranges) {
+            copied = sendfile(local_fd, fd, &pos, size - pos);
+        }
+        if (copied <= 0) {
+            break; /* The file shrank */
+        }
+    }
+    close(fd);
+    return pos;
+}
+
 /**
  * @brief Gets [size] from the server, to be used after receiving an OK from the server
  * @param sock file descriptor of the server
@@ -351,47 +582,73 @@ ssize_t check_for_extra_data(const int sock) {
  * @brief sends a GET request to the server specified by sock
  * @param sock file descriptor of the server
  * @param args list of arguments from parse_args
+ * @param from_cache true if sock is connected to a sub-server taken from the location cache
  */
-void get(int sock, char** args) {
+void get(int sock, char** args, bool from_cache) {
     const char* remote_file = args[3];
     const char* local_file = args[4];
+    // On this host the server can hand us the file itself, which compressing would only slow down
+    const bool local = connected_locally(sock);
+    const bool compress = !local && compression_enabled();
     char* header_msg;
-    asprintf(&header_msg, "GET %s\n", remote_file);
+    asprintf(&header_msg, "%s %s\n", local ? "FGET" : compress ? "ZGET" : "GET", remote_file);
     const size_t header_msg_len = strlen(header_msg);
 
-    char ip_addr[32] = {0};
-    char port[32] = {0};
+    char ip_addr[64] = {0};
+    char port[64] = {0};
+    bool reconnected;
     do {
+        reconnected = false;
         if (write_all_to_server(sock, header_msg, header_msg_len) != header_msg_len) {
             free(header_msg);
             exit(1);
         }
         shutdown(sock, SHUT_WR);
 
-        if (parse_header(sock)) {
+        if (read_response_header(sock, !from_cache)) {
             // Now, we get <ip addr:str>\n<port:str>\n
-            read_line_from_server(sock, ip_addr, 64);
-            read_line_from_server(sock, port, 64);
+            read_line_from_server(sock, ip_addr, sizeof(ip_addr));
+            read_line_from_server(sock, port, sizeof(port));
             if (strcmp(ip_addr, "0.0.0.0") != 0) {
                 // We need to reconnect to the new server and resend the request
+                location_cache_store(remote_file, ip_addr, port);
                 shutdown(sock, SHUT_RD);
                 close(sock);
                 sock = connect_to_server(sock, ip_addr, port);
+                reconnected = true;
                 continue;
             }
-            // read the size
+            // read the encoding and the size
+            char encoding = COMPRESS_RAW;
+            int passed_fd = -1;
+            if ((compress && read_all_from_server(sock, &encoding, 1) != 1) ||
+                (local && !read_encoding_and_fd(sock, &encoding, &passed_fd))) {
+                exit(1);
+            }
             const size_t file_size = get_size(sock);
             const int local_fd = open(local_file, O_WRONLY | O_CREAT | O_TRUNC, 0777);
-            char buffer[1024];
-            size_t cur_read = 0;
             size_t total_read = 0;
-            while ((cur_read = read_all_from_server(sock, buffer, 1024)) != 0) {
-                total_read += cur_read;
+            if (encoding == FGET_PASSED_FD) {
+                if (passed_fd != -1) {
+                    total_read = copy_passed_file(passed_fd, local_fd, file_size);
+                }
+            } else if (encoding == COMPRESS_ZLIB) {
+                total_read = receive_compressed(sock, local_fd);
                 if (total_read > file_size) {
                     print_received_too_much_data();
                     exit(1);
                 }
-                write(local_fd, buffer, cur_read);
+            } else {
+                char buffer[1024];
+                size_t cur_read = 0;
+                while ((cur_read = read_all_from_server(sock, buffer, 1024)) != 0) {
+                    total_read += cur_read;
+                    if (total_read > file_size) {
+                        print_received_too_much_data();
+                        exit(1);
+                    }
+                    write(local_fd, buffer, cur_read);
+                }
             }
             if (total_read < file_size) {
                 print_too_little_data();
@@ -399,8 +656,15 @@ void get(int sock, char** args) {
                 print_received_too_much_data();
             }
             shutdown(sock, SHUT_RD);
+        } else if (from_cache) {
+            // The cached sub-server doesn't have the file anymore, fall back to the main server
+            location_cache_invalidate(remote_file);
+            close(sock);
+            sock = connect_to_server(sock, args[0], args[1]);
+            from_cache = false;
+            reconnected = true;
         }
-    } while (strcmp(ip_addr, "0.0.0.0") != 0);
+    } while (reconnected);
 
     free(header_msg);
 }
@@ -409,8 +673,9 @@ void get(int sock, char** args) {
  * @brief sends a PUT request to the server specified by sock
  * @param sock file descriptor of the server
  * @param args list of arguments from parse_args
+ * @param from_cache true if sock is connected to a sub-server taken from the location cache
  */
-void put(int sock, char** args) {
+void put(int sock, char** args, bool from_cache) {
     const char* local_file = args[4];
     const char* remote_file = args[3];
     const int fd = open(local_file, O_RDONLY);
@@ -418,56 +683,180 @@ void put(int sock, char** args) {
         perror("file does not exist");
         exit(1);
     }
+    struct stat local_stat;
+    if (fstat(fd, &local_stat) == 0 && local_stat.st_size >= LINK_MIN_SIZE) {
+        if (link_by_hash(sock, remote_file, fd, local_stat.st_size)) {
+            print_success();
+            close(fd);
+            return;
+        }
+        // The server needs the contents after all, which takes a new connection. If it turned the LINK away as busy,
+        // the PUT decides whether to try again
+        busy_retry_after = 0;
+        close(sock);
+        sock = connect_for_file(args, &from_cache);
+    }
     // First, write the PUT request and the remote file name
+    const bool compress = compression_enabled();
     char* header_msg;
-    asprintf(&header_msg, "PUT %s\n", remote_file);
+    asprintf(&header_msg, "%s %s\n", compress ? "ZPUT" : "PUT", remote_file);
     const size_t header_msg_len = strlen(header_msg);
 
-    char ip_addr[32] = {0};
-    char port[32] = {0};
+    char ip_addr[64] = {0};
+    char port[64] = {0};
+    bool reconnected;
     do {
+        reconnected = false;
         if (write_all_to_server(sock, header_msg, header_msg_len) != header_msg_len) {
             free(header_msg);
             exit(1);
         }
         // Now, we get <ip addr:str>\n<port:str>\n
-        read_line_from_server(sock, ip_addr, 64);
+        if (read_line_from_server(sock, ip_addr, sizeof(ip_addr)) == -1 ||
+            read_line_from_server(sock, port, sizeof(port)) == -1) {
+            if (!from_cache) {
+                print_connection_closed();
+                exit(1);
+            }
+            // The cached sub-server went away, fall back to the main server
+            location_cache_invalidate(remote_file);
+            close(sock);
+            sock = connect_to_server(sock, args[0], args[1]);
+            from_cache = false;
+            reconnected = true;
+            continue;
+        }
+        if (strcmp(ip_addr, "ERROR") == 0) {
+            // Turned away before the upload started, the second line holds the reason
+            if (!server_busy(port) || last_attempt) {
+                print_error_message(port);
+            }
+            break;
+        }
         printf("%s\n",ip_addr);
-        read_line_from_server(sock, port, 64);
         printf("%s\n", port);
         if (strcmp(ip_addr, "0.0.0.0") != 0) {
             // We need to reconnect to the new server and resend the request
+            location_cache_store(remote_file, ip_addr, port);
             shutdown(sock, SHUT_RD);
             close(sock);
             sock = connect_to_server(sock, ip_addr, port);
+            reconnected = true;
             continue;
         }
-        // Next, write file size
+        // Next, write the encoding and the file size
         struct stat file_stat;
         fstat(fd, &file_stat);
         const size_t file_size = file_stat.st_size;
-        if (write_all_to_server(sock, &file_size, sizeof(file_size)) != sizeof(file_size)) {
+        const char encoding = compress && compress_worthwhile(fd, 0, file_size) ? COMPRESS_ZLIB : COMPRESS_RAW;
+        char size_header[1 + sizeof(file_size)];
+        size_t size_header_len = 0;
+        if (compress) {
+            size_header[size_header_len++] = encoding;
+        }
+        memcpy(size_header + size_header_len, &file_size, sizeof(file_size));
+        size_header_len += sizeof(file_size);
+        // Sent along with the first contents
+        if (send_all_to_server(sock, size_header, size_header_len, file_size > 0 ? MSG_MORE : 0) != size_header_len) {
             exit(1);
         }
 
         // Now, we need to write the actual file to the server
-        char* buffer[1024];
-        ssize_t read_result = 0;
-        do {
-            read_result = read(fd, buffer, 1024);
-            if (read_result != 0 && read_result != -1) {
-                write_all_to_server(sock, buffer, read_result);
+        if (encoding == COMPRESS_ZLIB) {
+            if (!send_compressed(sock, fd, file_size)) {
+                exit(1);
             }
-        } while (read_result != 0 && read_result != -1);
+        } else {
+            char buffer[PUT_BUFFER_SIZE];
+            ssize_t read_result = 0;
+            do {
+                read_result = read(fd, buffer, sizeof(buffer));
+                if (read_result != 0 && read_result != -1) {
+                    write_all_to_server(sock, buffer, read_result);
+                }
+            } while (read_result != 0 && read_result != -1);
+        }
 
         shutdown(sock, SHUT_WR);
         if (parse_header(sock)) {
             print_success();
         }
         shutdown(sock, SHUT_RD);
-    } while (strcmp(ip_addr, "0.0.0.0") != 0);
+    } while (reconnected);
+
+    free(header_msg);
+}
 
+/**
+ * @brief Offers the contents of `fd` to the server by their SHA-256, so it can store them without an upload
+ * if it already has them under another name.
+ * @param sock file descriptor of the server, not usable for another request afterwards
+ * @param size size of the file
+ * @return true if the server stored `remote_file`
+ */
+bool link_by_hash(const int sock, const char* remote_file, const int fd, const size_t size) {
+    unsigned char digest[SHA256_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    if (!sha256_fd(fd, 0, size, digest)) {
+        return false;
+    }
+    sha256_to_hex(digest, hex);
+    char* header_msg;
+    asprintf(&header_msg, "LINK %s %s\n", remote_file, hex);
+    const size_t header_msg_len = strlen(header_msg);
+    const bool sent = write_all_to_server(sock, header_msg, header_msg_len) == header_msg_len;
     free(header_msg);
+    shutdown(sock, SHUT_WR);
+    // Servers that do not have the contents (or do not know LINK) answer with an error we don't report
+    return sent && read_response_header(sock, false);
+}
+
+/**
+ * @return false if the user turned compression off with COMPRESS_ENV
+ */
+bool compression_enabled(void) {
+    const char* setting = getenv(COMPRESS_ENV);
+    return setting == NULL || strcmp(setting, "0") != 0;
+}
+
+static void write_to_fd(void* ctx, const void* data, const size_t size) {
+    write(*(int*)ctx, data, size);
+}
+
+/**
+ * @brief Decompresses the zlib stream the server sends into `fd`, up to its end or until the connection closes.
+ * @return the number of decompressed bytes written, which falls short of the size the server announced if the
+ * stream was cut off or damaged
+ */
+size_t receive_compressed(const int sock, int fd) {
+    compress_stream* stream = compress_stream_create(false, 0);
+    const off_t start = lseek(fd, 0, SEEK_CUR);
+    char buffer[4096];
+    ssize_t cur_read;
+    int result = 0;
+    while (result == 0 && (cur_read = read(sock, buffer, sizeof(buffer))) > 0) {
+        result = compress_stream_write(stream, buffer, cur_read, write_to_fd, &fd);
+    }
+    compress_stream_destroy(stream);
+    const off_t end = lseek(fd, 0, SEEK_CUR);
+    return result == 1 ? (size_t)(end - start) : 0;
+}
+
+/**
+ * @brief Sends a zlib stream of the `size` bytes of `fd` to the server.
+ * @return false if the connection failed
+ */
+bool send_compressed(const int sock, const int fd, const size_t size) {
+    compress_stream* stream = compress_stream_create(true, COMPRESS_STORE_LEVEL);
+    char buffer[64 * 1024];
+    off_t pos = 0;
+    ssize_t produced;
+    bool ok = true;
+    while (ok && (produced = compress_stream_read(stream, fd, &pos, (off_t)size, buffer, sizeof(buffer))) > 0) {
+        ok = write_all_to_server(sock, buffer, produced) == (size_t)produced;
+    }
+    compress_stream_destroy(stream);
+    return ok && produced == 0;
 }
 
 /**
@@ -521,6 +910,48 @@ void list(const int sock) {
     shutdown(sock, SHUT_RD);
 }
 
+/**
+ * @brief sends a LIST_ALL request to the server specified by sock.
+ * The server asks every sub-server for its files instead of answering from its own records,
+ * and tells us how many of them answered before its deadline.
+ * @param sock file descriptor of the server
+ */
+void list_all(const int sock) {
+    if (write_all_to_server(sock, "LIST_ALL\n", 9) != 9) {
+        print_connection_closed();
+        exit(1);
+    }
+    shutdown(sock, SHUT_WR);
+    if (parse_header(sock)) {
+        // <answered>/<queried>\n comes before the usual LIST response
+        char status[64];
+        size_t answered = 0, queried = 0;
+        if (read_line_from_server(sock, status, sizeof(status)) == -1 ||
+            sscanf(status, "%zu/%zu", &answered, &queried) != 2) {
+            print_invalid_response();
+            exit(1);
+        }
+        const size_t size = get_size(sock);
+        char* list = malloc(size + 1);
+        if (read_all_from_server(sock, list, size) != size) {
+            print_too_little_data();
+            print_connection_closed();
+            exit(1);
+        }
+        list[size] = '\0';
+        printf("%s\n", list);
+        if (answered < queried) {
+            print_partial_listing(answered, queried);
+        }
+        const ssize_t extra_data = check_for_extra_data(sock);
+        if (extra_data != 0) {
+            print_received_too_much_data();
+        }
+        free(list);
+    }
+    shutdown(sock, SHUT_RD);
+}
+
 void get_my_ip_addr(char* ipaddr) {
     int sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) {
@@ -555,78 +986,30 @@ void get_my_ip_addr(char* ipaddr) {
 }
 
 
-void add_server(int sock) {
-    // Read the list of files from the server
-    char* header_msg;
-    // TODO get ip address here
-    char ipaddr[INET_ADDRSTRLEN];
+/**
+ * @brief Turns this machine into a sub-server of the main server specified by sock.
+ * The sub-server registers itself over a SYNC connection, sends its files as a snapshot
+ * and keeps the main server informed of every change afterwards.
+ * @param sock file descriptor of the main server, only used to check that it is reachable
+ * @param args list of arguments from parse_args
+ */
+void add_server(int sock, char** args) {
+    close(sock);
+    char ipaddr[INET_ADDRSTRLEN] = {0};
     get_my_ip_addr(ipaddr);
-    asprintf(&header_msg, "ADD_SERVER %s 8080\n", ipaddr);
-    const size_t header_msg_len = strlen(header_msg);
-    if (write_all_to_server(sock, header_msg, header_msg_len) != header_msg_len) {
-        free(header_msg);
-        exit(1);
-    }
+    char* main_arg;
+    asprintf(&main_arg, "--main=%s:%s", args[0], args[1]);
 
-    // scrape files
-    struct dirent* entry;
-    vector* files = string_vector_create();
-    DIR* dir = opendir("Pi-Share");
-    if (dir == NULL) {
-        if (errno != ENOENT) {
-            perror("opendir() failed");
-            exit(1);
-        }
+    printf("Starting server...\n");
+    if (ipaddr[0] == '\0') { // The sub-server advertises the address the main server sees it at instead
+        execlp("./server", "./server", main_arg, "8080", NULL);
     } else {
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                continue;
-            }
-            struct stat entry_stat;
-            char full_path[1024];
-            snprintf(full_path, sizeof(full_path), "%s/%s", "Pi-Share", entry->d_name);
-            if (stat(full_path, &entry_stat) == 0 && S_ISREG(entry_stat.st_mode)) {
-                vector_push_back(files, entry->d_name);
-            }
-        }
-        closedir(dir);
-    }
-
-    size_t buffer_size = 128;
-    char* file_list = malloc(buffer_size);
-    size_t total_bytes = 0;
-    VECTOR_FOR_EACH(
-        files, file,
-        const size_t len = strlen(file);
-        if (total_bytes + len + 1 >= buffer_size) {
-        buffer_size *= 2;
-        file_list = realloc(file_list, buffer_size);
-        }
-        memcpy(file_list + total_bytes, file, len);
-        total_bytes += len;
-        file_list[total_bytes++] = '\n';
-    );
-    if (total_bytes > 0) {
-        --total_bytes;
+        char* advertise_arg;
+        asprintf(&advertise_arg, "--advertise=%s", ipaddr);
+        execlp("./server", "./server", main_arg, advertise_arg, "8080", NULL);
+        free(advertise_arg);
     }
-    // write bytes to read
-    if (write_all_to_server(sock, &total_bytes, sizeof(total_bytes)) != sizeof(total_bytes)) {
-        return;
-    }
-    // write file names
-    if (write_all_to_server(sock, file_list, (ssize_t)total_bytes) != total_bytes) {
-        return;
-    }
-    free(file_list);
-    vector_destroy(files);
-    shutdown(sock, SHUT_WR);
-    free(header_msg);
-    if (parse_header(sock)) {
-        print_success();
-    }
-    shutdown(sock, SHUT_RD);
-
-    printf("Starting server...\n");
-    execlp("./server", "./server", "8080", NULL);
-    printf("It came back from narnia bruh\n");
+    perror("execlp() failed");
+    free(main_arg);
+    exit(1);
 }
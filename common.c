@@ -2,9 +2,31 @@
  * nonstop_networking
  * CS 341 - Spring 2025
  */
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+
 #include "common.h"
 
 const size_t list_request_size = 5; // space for LIST\n
 const size_t min_server_response_header_size = 3; // space for OK\n
 const size_t max_server_response_header_size = 6; // space for ERROR\n
-const size_t max_verb_size = 6; // space for DELETE
\ No newline at end of file
+const size_t max_verb_size = 6; // space for DELETE
+
+bool spawn_detached(void* (*fn)(void*), void* arg) {
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    const int error = pthread_create(&thread, NULL, fn, arg);
+    if (error == 0) {
+        pthread_detach(thread);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (error != 0) {
+        LOG("pthread_create() failed: %s", strerror(error));
+        return false;
+    }
+    return true;
+}
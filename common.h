@@ -3,6 +3,7 @@
  * CS 341 - Spring 2025
  */
 #pragma once
+#include <stdbool.h>
 #include <stddef.h>
 #include <sys/types.h>
 
@@ -17,4 +18,19 @@ extern const size_t max_verb_size;
         fprintf(stderr, "\n");        \
     } while (0);
 
-typedef enum { GET, PUT, DELETE, LIST, ADD_SERVER, V_UNKNOWN } verb;
+/**
+ * @brief Starts a detached thread running `fn(arg)` with all signals blocked, as they are handled by the epoll thread
+ * (so that SIGINT interrupts epoll_wait).
+ * @return false if the thread could not be created
+ */
+bool spawn_detached(void* (*fn)(void*), void* arg);
+
+typedef enum { GET, PUT, DELETE, LIST, ADD_SERVER, LIST_ALL, SYNC, LINK, V_UNKNOWN } verb;
+
+// Uploads of at least this many bytes are first offered by their SHA-256 with `LINK <name> <hex>\n`
+#define LINK_MIN_SIZE (64 * 1024)
+
+// `FGET <name>\n` is a GET whose size is preceded by an encoding byte like that of ZGET. Over the Unix domain socket
+// it can be FGET_PASSED_FD: the contents do not follow, the file comes along with that byte as an open read-only
+// descriptor (SCM_RIGHTS) for the client to copy the size from
+#define FGET_PASSED_FD 'F'
@@ -0,0 +1,134 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "compress.h"
+
+#define COMPRESS_BUFFER_SIZE (64 * 1024)
+#define COMPRESS_MAX_RATIO 0.9 // Compressing has to save at least a tenth to be worth it
+
+struct compress_stream {
+    z_stream z;
+    bool deflating;
+    bool finished;
+    unsigned char in[COMPRESS_BUFFER_SIZE];
+};
+
+bool compress_worthwhile(const int fd, const off_t offset, const size_t size) {
+    if (size < COMPRESS_MIN_SIZE) {
+        return false;
+    }
+    const size_t sample_size = size < COMPRESS_SAMPLE_SIZE ? size : COMPRESS_SAMPLE_SIZE;
+    unsigned char* sample = malloc(sample_size);
+    uLongf compressed_size = compressBound(sample_size);
+    unsigned char* compressed = malloc(compressed_size);
+    const bool worthwhile = pread(fd, sample, sample_size, offset) == (ssize_t)sample_size &&
+                            compress2(compressed, &compressed_size, sample, sample_size, Z_BEST_SPEED) == Z_OK &&
+                            compressed_size < sample_size * COMPRESS_MAX_RATIO;
+    free(sample);
+    free(compressed);
+    return worthwhile;
+}
+
+bool compress_mark_stored(const int fd, const size_t raw_size) {
+    const uint64_t size = raw_size;
+    return fsetxattr(fd, COMPRESS_XATTR, &size, sizeof(size), 0) == 0;
+}
+
+void compress_unmark_stored(const int fd) {
+    fremovexattr(fd, COMPRESS_XATTR); /* Fails if it was not marked, which is fine */
+}
+
+bool compress_is_stored(const int fd, size_t* raw_size) {
+    uint64_t stored_size;
+    if (fgetxattr(fd, COMPRESS_XATTR, &stored_size, sizeof(stored_size)) != sizeof(stored_size)) {
+        return false;
+    }
+    *raw_size = stored_size;
+    return true;
+}
+
+compress_stream* compress_stream_create(const bool deflating, const int level) {
+    compress_stream* stream = calloc(1, sizeof(compress_stream));
+    stream->deflating = deflating;
+    const int result = deflating ? deflateInit(&stream->z, level) : inflateInit(&stream->z);
+    if (result != Z_OK) {
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+void compress_stream_destroy(compress_stream* stream) {
+    if (stream == NULL) {
+        return;
+    }
+    if (stream->deflating) {
+        deflateEnd(&stream->z);
+    } else {
+        inflateEnd(&stream->z);
+    }
+    free(stream);
+}
+
+ssize_t compress_stream_read(compress_stream* stream, const int fd, off_t* pos, const off_t end, void* out,
+                             const size_t size) {
+    stream->z.next_out = out;
+    stream->z.avail_out = size;
+    while (!stream->finished && stream->z.avail_out > 0) {
+        if (stream->z.avail_in == 0 && *pos < end) {
+            const size_t want = end - *pos < COMPRESS_BUFFER_SIZE ? end - *pos : COMPRESS_BUFFER_SIZE;
+            const ssize_t read_result = pread(fd, stream->in, want, *pos);
+            if (read_result <= 0) {
+                return -1;
+            }
+            *pos += read_result;
+            stream->z.next_in = stream->in;
+            stream->z.avail_in = read_result;
+        }
+        /* Once everything was read, the deflater can finish the stream */
+        const int result = stream->deflating ? deflate(&stream->z, *pos == end ? Z_FINISH : Z_NO_FLUSH)
+                                             : inflate(&stream->z, Z_NO_FLUSH);
+        if (result == Z_STREAM_END) {
+            stream->finished = true;
+        } else if (result == Z_BUF_ERROR && !stream->deflating && stream->z.avail_in == 0 && *pos == end) {
+            return -1; /* The stream ends early */
+        } else if (result != Z_OK && result != Z_BUF_ERROR) {
+            return -1;
+        }
+    }
+    return (ssize_t)(size - stream->z.avail_out);
+}
+
+int compress_stream_write(compress_stream* stream, const void* data, const size_t size,
+                          void (*sink)(void* ctx, const void* data, size_t size), void* ctx) {
+    if (stream->finished) {
+        return 1;
+    }
+    unsigned char out[COMPRESS_BUFFER_SIZE];
+    stream->z.next_in = (unsigned char*)data;
+    stream->z.avail_in = size;
+    do {
+        stream->z.next_out = out;
+        stream->z.avail_out = sizeof(out);
+        const int result = inflate(&stream->z, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+            return -1;
+        }
+        if (sizeof(out) > stream->z.avail_out) {
+            sink(ctx, out, sizeof(out) - stream->z.avail_out);
+        }
+        if (result == Z_STREAM_END) {
+            stream->finished = true;
+            return 1;
+        }
+    } while (stream->z.avail_in > 0 || stream->z.avail_out == 0);
+    return 0;
+}
@@ -0,0 +1,79 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * zlib compression of transfers and of stored files.
+ *
+ * On the wire, `ZGET <name>\n` and `ZPUT <name>\n` work like GET and PUT, except that the size is preceded by an
+ * encoding byte: COMPRESS_RAW if the contents follow as they are, COMPRESS_ZLIB if a zlib stream of them follows.
+ * The size is always that of the uncompressed contents. The sender picks the encoding per transfer.
+ *
+ * On disk, a file can be stored as a zlib stream of its contents. Such files carry the extended attribute
+ * COMPRESS_XATTR with their uncompressed size as uint64_t, so an upload that happens to look like one is still
+ * served as it was uploaded. Servers read them back for GET and hand them to other servers with ZPUT.
+ */
+#define COMPRESS_RAW 'R'
+#define COMPRESS_ZLIB 'Z'
+
+// Environment variable the client reads, `0` makes it use plain GET and PUT (for servers without ZGET and ZPUT)
+#define COMPRESS_ENV "PI_SHARE_COMPRESS"
+
+#define COMPRESS_XATTR "user.pi-share.zlib"
+#define COMPRESS_MIN_SIZE 1024 // Smaller files are always sent as they are
+#define COMPRESS_SAMPLE_SIZE (64 * 1024) // Bytes compressed to guess whether compressing a file is worth it
+#define COMPRESS_FAST_LEVEL 1 // Level for compressing while sending, where speed matters more than size
+#define COMPRESS_STORE_LEVEL 6 // Level for uploads, which servers may keep compressed
+
+/**
+ * @brief Guesses whether compressing the `size` bytes of `fd` starting at `offset` saves enough to be worth it,
+ * by compressing their beginning.
+ */
+bool compress_worthwhile(int fd, off_t offset, size_t size);
+
+/**
+ * @brief Marks `fd` as a stored compressed file of `raw_size` uncompressed bytes.
+ * @return false if it could not be marked (the file system may not support extended attributes)
+ */
+bool compress_mark_stored(int fd, size_t raw_size);
+
+/**
+ * @brief Takes the mark of compress_mark_stored off `fd`, if it has one. Call before reusing a file for new contents.
+ */
+void compress_unmark_stored(int fd);
+
+/**
+ * @brief Checks whether `fd` is a stored compressed file.
+ * @param raw_size receives its uncompressed size
+ */
+bool compress_is_stored(int fd, size_t* raw_size);
+
+typedef struct compress_stream compress_stream;
+
+/**
+ * @param deflating true to compress, false to decompress
+ * @param level zlib compression level, ignored when decompressing
+ */
+compress_stream* compress_stream_create(bool deflating, int level);
+
+void compress_stream_destroy(compress_stream* stream);
+
+/**
+ * @brief Compresses or decompresses the bytes of `fd` from `*pos` to `end` into `out`, reading as needed.
+ * @param pos advanced past the bytes read
+ * @return the number of bytes written to `out`, 0 once the whole stream was produced, -1 on corrupt input
+ */
+ssize_t compress_stream_read(compress_stream* stream, int fd, off_t* pos, off_t end, void* out, size_t size);
+
+/**
+ * @brief Decompresses `size` more bytes of a zlib stream, passing what comes out to `sink`.
+ * @return 1 once the end of the stream was reached (later input is ignored), 0 if more is expected,
+ * -1 on corrupt input
+ */
+int compress_stream_write(compress_stream* stream, const void* data, size_t size,
+                          void (*sink)(void* ctx, const void* data, size_t size), void* ctx);
@@ -0,0 +1,164 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "dedup.h"
+
+#define DEDUP_INCOMING "incoming." // Prefix of uploads in progress inside DEDUP_DIR
+
+static bool enabled = false;
+static bool present = false; // DEDUP_DIR exists
+
+static void object_path(const unsigned char digest[SHA256_SIZE], char* path) {
+    char hex[SHA256_HEX_SIZE];
+    sha256_to_hex(digest, hex);
+    snprintf(path, 128, DEDUP_DIR "/%.2s/%s", hex, hex);
+}
+
+void dedup_init(const char* dir, const bool enable) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, DEDUP_DIR);
+    if (enable) {
+        if (mkdir(path, 0777) == -1 && errno != EEXIST) {
+            perror("creating the object directory failed");
+            return;
+        }
+        for (int i = 0; i < 256; ++i) {
+            snprintf(path, sizeof(path), "%s/%s/%02x", dir, DEDUP_DIR, i);
+            if (mkdir(path, 0777) == -1 && errno != EEXIST) {
+                perror("creating the object directory failed");
+                return;
+            }
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, DEDUP_DIR);
+    }
+    DIR* d = opendir(path);
+    if (d == NULL) {
+        return;
+    }
+    /* Uploads that were in progress when we stopped */
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strncmp(entry->d_name, DEDUP_INCOMING, strlen(DEDUP_INCOMING)) == 0) {
+            unlinkat(dirfd(d), entry->d_name, 0);
+        }
+    }
+    closedir(d);
+    present = true;
+    enabled = enable;
+}
+
+bool dedup_enabled(void) {
+    return enabled;
+}
+
+bool dedup_has_objects(void) {
+    return present;
+}
+
+void dedup_incoming_path(const unsigned long id, char* path) {
+    snprintf(path, 64, DEDUP_DIR "/" DEDUP_INCOMING "%lu", id);
+}
+
+/**
+ * @brief Links `object` as `path`, through the temporary name `temp` so `path` is replaced in one step.
+ */
+static bool link_into_place(const char* object, const char* temp, const char* path) {
+    if (link(object, temp) == -1) {
+        return false;
+    }
+    if (rename(temp, path) == -1) {
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+bool dedup_commit(const unsigned long id, const unsigned char digest[SHA256_SIZE], const char* path) {
+    char incoming[64];
+    dedup_incoming_path(id, incoming);
+    if (digest != NULL) {
+        char object[128];
+        char linked[80];
+        object_path(digest, object);
+        snprintf(linked, sizeof(linked), "%s.link", incoming);
+        if (link(incoming, object) == -1 && errno == EEXIST && link_into_place(object, linked, path)) {
+            /* Same contents as an object we already have, keep that one and drop the copy */
+            unlink(incoming);
+            return true;
+        }
+        /* Even if the object could not be shared, the upload is still good as a file of its own */
+    }
+    if (rename(incoming, path) == -1) {
+        unlink(incoming);
+        return false;
+    }
+    return true;
+}
+
+bool dedup_link(const unsigned long id, const unsigned char digest[SHA256_SIZE], const char* path) {
+    if (!present) {
+        return false;
+    }
+    char incoming[64];
+    char object[128];
+    dedup_incoming_path(id, incoming);
+    object_path(digest, object);
+    return link_into_place(object, incoming, path);
+}
+
+/**
+ * @brief Removes the objects that are only linked from DEDUP_DIR.
+ * An object can get a new link between the check and the removal, which then just isn't shared anymore.
+ */
+static void sweep(void) {
+    char shard[64];
+    size_t removed = 0;
+    for (int i = 0; i < 256; ++i) {
+        snprintf(shard, sizeof(shard), DEDUP_DIR "/%02x", i);
+        DIR* d = opendir(shard);
+        if (d == NULL) {
+            continue;
+        }
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            struct stat s;
+            if (entry->d_name[0] != '.' && fstatat(dirfd(d), entry->d_name, &s, AT_SYMLINK_NOFOLLOW) == 0 &&
+                s.st_nlink == 1 && unlinkat(dirfd(d), entry->d_name, 0) == 0) {
+                ++removed;
+            }
+        }
+        closedir(d);
+    }
+    if (removed > 0) {
+        LOG("dedup: removed %zu objects that are not used anymore", removed);
+    }
+}
+
+static void* sweeper(void* arg) {
+    (void)arg;
+    while (true) {
+        sleep(DEDUP_SWEEP_INTERVAL);
+        sweep();
+    }
+    return NULL;
+}
+
+void dedup_start_sweeper(void) {
+    if (!present) {
+        return;
+    }
+    if (!spawn_detached(sweeper, NULL)) {
+        exit(1);
+    }
+}
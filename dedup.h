@@ -0,0 +1,62 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+
+#include "sha256.h"
+
+/**
+ * Content-addressed storage of loose files: with --dedup, every uploaded file is also linked as
+ * Pi-Share/DEDUP_DIR/<first two hex digits>/<SHA-256 in hex>, and a later upload with the same contents becomes
+ * another hard link to that object instead of a copy. Clients (and the rebalancer) offer a file by its hash with
+ * LINK before uploading it, so contents the server already has are not sent at all.
+ *
+ * Objects nobody links to anymore are removed in the background. Since names share an inode with their object,
+ * files must never be modified in place; the server always writes a new file and renames it over the old one.
+ *
+ * All paths are relative to the share directory, which has to be the working directory once dedup_init returned.
+ */
+#define DEDUP_DIR ".pi-share-objects"
+#define DEDUP_SWEEP_INTERVAL 60 // Seconds between looks for objects that are not linked anymore
+
+/**
+ * @brief Prepares the object directory of the share directory `dir`.
+ * @param enabled whether uploads are stored by their hash, LINK works either way for objects that already exist
+ */
+void dedup_init(const char* dir, bool enabled);
+
+bool dedup_enabled(void);
+
+/**
+ * @brief Whether files in the share may be links to objects. Uploads then have to be written to the path given by
+ * dedup_incoming_path and moved into place with dedup_commit, even while hashing is disabled.
+ */
+bool dedup_has_objects(void);
+
+/**
+ * @brief Writes the path that the upload with the unique `id` is written to before dedup_commit to `path`.
+ * @param id never used for another upload while this one may still be on disk
+ * @param path at least 64 bytes
+ */
+void dedup_incoming_path(unsigned long id, char* path);
+
+/**
+ * @brief Stores the finished upload `id` with the contents `digest` as `path`, sharing the object if one exists.
+ * @param digest NULL to store it without creating an object
+ * @return false if it could not be moved into place, the upload is removed then
+ */
+bool dedup_commit(unsigned long id, const unsigned char digest[SHA256_SIZE], const char* path);
+
+/**
+ * @brief Makes `path` another link to the object with the contents `digest`.
+ * @param id unique id used for the temporary name, see dedup_incoming_path
+ * @return false if there is no such object
+ */
+bool dedup_link(unsigned long id, const unsigned char digest[SHA256_SIZE], const char* path);
+
+/**
+ * @brief Starts the background thread that removes unused objects.
+ */
+void dedup_start_sweeper(void);
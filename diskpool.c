@@ -0,0 +1,143 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "diskpool.h"
+#include "includes/queue.h"
+#include "includes/vector.h"
+
+struct disk_job {
+    void (*work)(void* data);
+    void (*discard)(void* data);
+    int owner;
+    bool done; // Set by the worker
+    bool released; // Set by the epoll loop, whoever comes last frees the job
+    bool abandoned; // Released without taking the result
+    char data[];
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static queue* jobs; // disk_job*, NULL without workers
+static int event_fd = -1;
+static vector* finished_owners; // int owners of the jobs done since diskpool_handle_completions last ran
+
+/**
+ * @brief Frees `job` once it finished and was released, discarding its result if nobody took it.
+ * Called with `lock` held.
+ */
+static void job_unref(disk_job* job) {
+    if (!job->done || !job->released) {
+        return;
+    }
+    if (job->abandoned && job->discard != NULL) {
+        job->discard(job->data);
+    }
+    free(job);
+}
+
+static void* disk_worker(void* arg) {
+    (void)arg;
+    while (true) {
+        disk_job* job = queue_pull(jobs);
+        job->work(job->data);
+        pthread_mutex_lock(&lock);
+        vector_push_back(finished_owners, &job->owner);
+        job->done = true;
+        job_unref(job); /* Abandoned while we were working */
+        pthread_mutex_unlock(&lock);
+        const uint64_t one = 1;
+        write(event_fd, &one, sizeof(one));
+    }
+    return NULL;
+}
+
+void diskpool_init(const size_t threads) {
+    if (threads == 0) {
+        return;
+    }
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1) {
+        perror("eventfd() failed, doing file work on the epoll thread");
+        return;
+    }
+    jobs = queue_create(-1);
+    finished_owners = int_vector_create();
+
+    for (size_t i = 0; i < threads; ++i) {
+        if (!spawn_detached(disk_worker, NULL)) {
+            exit(1);
+        }
+    }
+}
+
+int diskpool_event_fd(void) {
+    return event_fd;
+}
+
+void diskpool_handle_completions(void (*finished)(int owner, void* arg), void* arg) {
+    uint64_t count;
+    read(event_fd, &count, sizeof(count));
+    pthread_mutex_lock(&lock);
+    vector* owners = finished_owners;
+    finished_owners = int_vector_create();
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < vector_size(owners); ++i) {
+        finished(*(int*)vector_get(owners, i), arg);
+    }
+    vector_destroy(owners);
+}
+
+disk_job* diskpool_submit(void (*work)(void* data), const void* data, const size_t size,
+                          void (*discard)(void* data), const int owner) {
+    disk_job* job = calloc(1, sizeof(disk_job) + size);
+    job->work = work;
+    job->discard = discard;
+    job->owner = owner;
+    memcpy(job->data, data, size);
+    if (jobs == NULL) {
+        work(job->data);
+        job->done = true;
+    } else {
+        queue_push(jobs, job);
+    }
+    return job;
+}
+
+bool diskpool_done(const disk_job* job) {
+    pthread_mutex_lock(&lock);
+    const bool done = job->done;
+    pthread_mutex_unlock(&lock);
+    return done;
+}
+
+void* diskpool_data(disk_job* job) {
+    return job->data;
+}
+
+static void release(disk_job* job, const bool abandoned) {
+    if (job == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    job->released = true;
+    job->abandoned = abandoned;
+    job_unref(job);
+    pthread_mutex_unlock(&lock);
+}
+
+void diskpool_release(disk_job* job) {
+    release(job, false);
+}
+
+void diskpool_abandon(disk_job* job) {
+    release(job, true);
+}
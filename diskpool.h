@@ -0,0 +1,64 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A pool of threads that does file work (opening, inspecting, committing and deleting files) for the epoll loop, so
+ * one client waiting for a slow disk does not hold up every other connection.
+ *
+ * The epoll loop submits a job and checks on it whenever the client's handler runs again; the eventfd returned by
+ * diskpool_event_fd becomes readable when a job finished, and diskpool_handle_completions names the sockets whose
+ * jobs finished, so a client can stay out of epoll while it waits.
+ * Jobs work on their own copy of the data they were submitted with, so they never touch a client_info.
+ */
+#define DISKPOOL_DEFAULT_THREADS 4
+
+typedef struct disk_job disk_job;
+
+/**
+ * @brief Starts the worker threads.
+ * @param threads number of workers, 0 runs every job right away on the calling thread
+ */
+void diskpool_init(size_t threads);
+
+/**
+ * @return the eventfd that becomes readable when jobs finished, -1 without workers
+ */
+int diskpool_event_fd(void);
+
+/**
+ * @brief Resets diskpool_event_fd and calls `finished` with the owner of every job that finished since the last call.
+ * Call when it is readable. Owners may have gone away meanwhile, and their socket may belong to someone else by now.
+ */
+void diskpool_handle_completions(void (*finished)(int owner, void* arg), void* arg);
+
+/**
+ * @brief Runs `work` on a worker thread with a copy of the `size` bytes of `data`.
+ * @param discard called with the copy once `work` is done if the job was abandoned, to free what `work` acquired;
+ * may be NULL
+ * @param owner socket of the client the job is for, see diskpool_handle_completions
+ * @return the job, to be checked with diskpool_done and given back with diskpool_release or diskpool_abandon
+ */
+disk_job* diskpool_submit(void (*work)(void* data), const void* data, size_t size, void (*discard)(void* data),
+                          int owner);
+
+bool diskpool_done(const disk_job* job);
+
+/**
+ * @return the copy of the data `work` ran on, once diskpool_done
+ */
+void* diskpool_data(disk_job* job);
+
+/**
+ * @brief Gives back a finished job whose result was taken.
+ */
+void diskpool_release(disk_job* job);
+
+/**
+ * @brief Gives back a job whose result is not wanted anymore. It is left to finish and then discarded.
+ */
+void diskpool_abandon(disk_job* job);
@@ -0,0 +1,237 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "catalog.h"
+#include "fanout.h"
+#include "includes/dictionary.h"
+#include "includes/set.h"
+
+typedef enum { PEER_CONNECTING, PEER_READING, PEER_DONE, PEER_FAILED } peer_state;
+
+typedef struct {
+    fanout* owner;
+    int fd;
+    peer_state state;
+    char header[3 + sizeof(size_t)]; // OK\n<size>
+    size_t header_read;
+    size_t expected;
+    size_t received;
+    char line[1024]; // Partial file name carried over between reads
+    size_t line_len;
+} peer_request;
+
+struct fanout {
+    int epoll_fd;
+    long long deadline; // CLOCK_MONOTONIC, in milliseconds
+    set* names;
+    peer_request* peers;
+    size_t count;
+    size_t pending;
+    size_t answered;
+};
+
+static dictionary* peers_by_fd; // Maps sub-server socket -> peer_request*
+static vector* active; // fanout* that still wait for sub-servers
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int connect_nonblocking(const server_info* server) {
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)strtoul(server->port, NULL, 10));
+    if (inet_pton(AF_INET, server->ip, &addr.sin_addr) != 1) {
+        return -1;
+    }
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void finish_peer(peer_request* p, const bool ok) {
+    if (p->state == PEER_DONE || p->state == PEER_FAILED) {
+        return;
+    }
+    if (ok && p->line_len > 0) { /* The last name of a listing is not followed by a newline */
+        p->line[p->line_len] = '\0';
+        set_add(p->owner->names, p->line);
+    }
+    epoll_ctl(p->owner->epoll_fd, EPOLL_CTL_DEL, p->fd, NULL);
+    dictionary_remove(peers_by_fd, &p->fd);
+    close(p->fd);
+    p->state = ok ? PEER_DONE : PEER_FAILED;
+    p->owner->pending--;
+    if (ok) {
+        p->owner->answered++;
+    }
+}
+
+fanout* fanout_start(const int epoll_fd, const int deadline_ms) {
+    if (peers_by_fd == NULL) {
+        peers_by_fd = int_to_shallow_dictionary_create();
+        active = shallow_vector_create();
+    }
+    fanout* f = calloc(1, sizeof(fanout));
+    f->epoll_fd = epoll_fd;
+    f->deadline = now_ms() + deadline_ms;
+    f->names = string_set_create();
+    const size_t servers = catalog_server_count();
+    f->peers = calloc(servers == 0 ? 1 : servers, sizeof(peer_request));
+
+    server_info server;
+    for (size_t i = 0; i < servers && catalog_get_server(i, &server); ++i) {
+        peer_request* p = &f->peers[f->count++];
+        p->owner = f;
+        p->state = PEER_FAILED;
+        p->fd = connect_nonblocking(&server);
+        if (p->fd == -1) {
+            continue;
+        }
+        struct epoll_event ev = {.events = EPOLLOUT, .data.fd = p->fd};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, p->fd, &ev) == -1) {
+            close(p->fd);
+            continue;
+        }
+        p->state = PEER_CONNECTING;
+        dictionary_set(peers_by_fd, &p->fd, p);
+        f->pending++;
+    }
+    vector_push_back(active, f);
+    return f;
+}
+
+bool fanout_owns(int fd) {
+    return peers_by_fd != NULL && dictionary_contains(peers_by_fd, &fd);
+}
+
+/**
+ * @brief Consumes `n` bytes of a LIST response, merging every complete file name into the fanout's set.
+ */
+static void consume_listing(peer_request* p, const char* data, size_t n) {
+    while (n > 0 && p->header_read < sizeof(p->header)) {
+        p->header[p->header_read++] = *data++;
+        --n;
+        if (p->header_read == sizeof(p->header)) {
+            if (strncmp(p->header, "OK\n", 3) != 0) {
+                finish_peer(p, false);
+                return;
+            }
+            memcpy(&p->expected, p->header + 3, sizeof(size_t));
+        }
+    }
+    for (size_t i = 0; i < n && p->received < p->expected; ++i, ++p->received) {
+        if (data[i] == '\n') {
+            p->line[p->line_len] = '\0';
+            if (p->line_len > 0) {
+                set_add(p->owner->names, p->line);
+            }
+            p->line_len = 0;
+        } else if (p->line_len < sizeof(p->line) - 1) {
+            p->line[p->line_len++] = data[i];
+        }
+    }
+    if (p->header_read == sizeof(p->header) && p->received == p->expected) {
+        finish_peer(p, true);
+    }
+}
+
+void fanout_handle_event(int fd, const uint32_t events) {
+    peer_request* p = dictionary_get(peers_by_fd, &fd);
+    if (p->state == PEER_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1 || err != 0 ||
+            write(fd, "LIST\n", 5) != 5) {
+            finish_peer(p, false);
+            return;
+        }
+        shutdown(fd, SHUT_WR);
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+        epoll_ctl(p->owner->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+        p->state = PEER_READING;
+        return;
+    }
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        return;
+    }
+    char buffer[4096];
+    while (p->state == PEER_READING) {
+        const ssize_t res = read(fd, buffer, sizeof(buffer));
+        if (res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (res <= 0) { /* The sub-server hung up before sending the whole listing */
+            finish_peer(p, false);
+            return;
+        }
+        consume_listing(p, buffer, res);
+    }
+}
+
+int fanout_next_timeout(void) {
+    if (active == NULL) {
+        return -1;
+    }
+    long long timeout = -1;
+    const long long now = now_ms();
+    VECTOR_FOR_EACH(
+        active, f,
+        if (((fanout*)f)->pending > 0) {
+        const long long left = ((fanout*)f)->deadline > now ? ((fanout*)f)->deadline - now : 0;
+        if (timeout == -1 || left < timeout) {
+        timeout = left;
+        }
+        }
+    );
+    return (int)timeout;
+}
+
+bool fanout_done(fanout* f) {
+    if (f->pending > 0 && now_ms() >= f->deadline) {
+        for (size_t i = 0; i < f->count; ++i) {
+            finish_peer(&f->peers[i], false);
+        }
+    }
+    return f->pending == 0;
+}
+
+vector* fanout_results(fanout* f, size_t* answered, size_t* queried) {
+    vector* names = string_vector_create();
+    vector_reserve(names, set_cardinality(f->names));
+    SET_FOR_EACH(f->names, name, vector_push_back(names, name););
+    *answered = f->answered;
+    *queried = f->count;
+    return names;
+}
+
+void fanout_destroy(fanout* f) {
+    for (size_t i = 0; i < f->count; ++i) {
+        finish_peer(&f->peers[i], false);
+    }
+    for (size_t i = 0; i < vector_size(active); ++i) {
+        if (vector_get(active, i) == f) {
+            vector_erase(active, i);
+            break;
+        }
+    }
+    set_destroy(f->names);
+    free(f->peers);
+    free(f);
+}
@@ -0,0 +1,59 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "includes/vector.h"
+
+// Default time a LIST_ALL waits for the sub-servers before answering with what it has, in milliseconds
+#define FANOUT_DEFAULT_DEADLINE 2000
+
+/**
+ * A LIST_ALL request in flight: a LIST sent to every sub-server at once over non-blocking sockets that share the
+ * server's epoll set. Listings are merged into one set of names as they stream in.
+ */
+typedef struct fanout fanout;
+
+/**
+ * @brief Sends LIST to every sub-server and registers the connections with `epoll_fd`.
+ * @param deadline_ms how long to wait for the sub-servers, in milliseconds
+ */
+fanout* fanout_start(int epoll_fd, int deadline_ms);
+
+/**
+ * @return true if `fd` is a sub-server connection belonging to some fanout
+ */
+bool fanout_owns(int fd);
+
+/**
+ * @brief Makes progress on the sub-server connection `fd` after epoll reported `events` on it.
+ */
+void fanout_handle_event(int fd, uint32_t events);
+
+/**
+ * @return the number of milliseconds until the nearest fanout deadline, or -1 if there is none.
+ * Meant to be used as the epoll_wait timeout.
+ */
+int fanout_next_timeout(void);
+
+/**
+ * @return true once every sub-server answered or the deadline passed. Connections still open are closed then.
+ */
+bool fanout_done(fanout* f);
+
+/**
+ * @brief Returns the merged listing of the sub-servers that answered.
+ * @param answered receives the number of sub-servers that sent a complete listing
+ * @param queried receives the number of sub-servers that were asked
+ * @return the file names, owned by the caller
+ */
+vector* fanout_results(fanout* f, size_t* answered, size_t* queried);
+
+/**
+ * @brief Releases `f`, closing any connection that is still open.
+ */
+void fanout_destroy(fanout* f);
@@ -0,0 +1,146 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fdcache.h"
+#include "layout.h"
+#include "includes/dictionary.h"
+
+struct fdcache_entry {
+    char* name;
+    int fd;
+    struct stat stat;
+    unsigned refs; // One per fdcache_open plus one while the entry is in the cache
+    fdcache_entry* prev; // Towards the most recently used
+    fdcache_entry* next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t max_entries;
+static dictionary* entries; // name -> fdcache_entry*
+static fdcache_entry* newest;
+static fdcache_entry* oldest;
+static unsigned long invalidations; // Counts fdcache_invalidate calls, to notice one while opening a file
+
+static void drop_ref(fdcache_entry* e) {
+    if (--e->refs == 0) {
+        close(e->fd);
+        free(e->name);
+        free(e);
+    }
+}
+
+static void unlink_entry(fdcache_entry* e) {
+    if (e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        newest = e->next;
+    }
+    if (e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        oldest = e->prev;
+    }
+}
+
+static void push_newest(fdcache_entry* e) {
+    e->prev = NULL;
+    e->next = newest;
+    if (newest != NULL) {
+        newest->prev = e;
+    } else {
+        oldest = e;
+    }
+    newest = e;
+}
+
+static void forget(fdcache_entry* e) {
+    unlink_entry(e);
+    dictionary_remove(entries, e->name);
+    drop_ref(e);
+}
+
+void fdcache_init(const size_t max_files) {
+    max_entries = max_files;
+    entries = dictionary_create(string_hash_function, string_compare, NULL, NULL, NULL, NULL);
+}
+
+fdcache_entry* fdcache_open(const char* name) {
+    pthread_mutex_lock(&lock);
+    if (dictionary_contains(entries, (void*)name)) {
+        fdcache_entry* e = dictionary_get(entries, (void*)name);
+        ++e->refs;
+        unlink_entry(e);
+        push_newest(e);
+        pthread_mutex_unlock(&lock);
+        return e;
+    }
+    const unsigned long seen_invalidations = invalidations;
+    pthread_mutex_unlock(&lock);
+
+    char path[LAYOUT_PATH_MAX];
+    const int fd = open(layout_path(name, path), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    fdcache_entry* e = calloc(1, sizeof(fdcache_entry));
+    e->fd = fd;
+    e->refs = 1;
+    if (fstat(fd, &e->stat) == -1) {
+        const int error = errno;
+        drop_ref(e);
+        errno = error;
+        return NULL;
+    }
+    if (max_entries == 0) {
+        return e;
+    }
+    e->name = strdup(name);
+    pthread_mutex_lock(&lock);
+    if (invalidations != seen_invalidations) {
+        /* The file may have been replaced after we opened it, use it this once but do not keep it */
+        pthread_mutex_unlock(&lock);
+        return e;
+    }
+    if (dictionary_contains(entries, (void*)name)) {
+        forget(dictionary_get(entries, (void*)name)); /* Opened by someone else meanwhile, ours is as fresh */
+    }
+    ++e->refs;
+    push_newest(e);
+    dictionary_set(entries, e->name, e);
+    while (dictionary_size(entries) > max_entries) {
+        forget(oldest);
+    }
+    pthread_mutex_unlock(&lock);
+    return e;
+}
+
+int fdcache_fd(const fdcache_entry* entry) {
+    return entry->fd;
+}
+
+const struct stat* fdcache_stat(const fdcache_entry* entry) {
+    return &entry->stat;
+}
+
+void fdcache_release(fdcache_entry* entry) {
+    pthread_mutex_lock(&lock);
+    drop_ref(entry);
+    pthread_mutex_unlock(&lock);
+}
+
+void fdcache_invalidate(const char* name) {
+    pthread_mutex_lock(&lock);
+    ++invalidations;
+    if (dictionary_contains(entries, (void*)name)) {
+        forget(dictionary_get(entries, (void*)name));
+    }
+    pthread_mutex_unlock(&lock);
+}
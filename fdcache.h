@@ -0,0 +1,44 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stddef.h>
+#include <sys/stat.h>
+
+/**
+ * Keeps recently downloaded files open, so repeated GETs of the same file skip resolving its path, open() and
+ * fstat(). Descriptors are opened read-only and only used with pread and sendfile at explicit offsets, so concurrent
+ * GETs share one.
+ *
+ * At most the configured number of files is kept open when nobody uses them, the least recently used one is closed
+ * first. Entries are reference counted, so a GET keeps reading its file after it was evicted or invalidated.
+ */
+#define FDCACHE_DEFAULT_SIZE 128
+
+typedef struct fdcache_entry fdcache_entry;
+
+/**
+ * @param max_files files kept open at most, 0 closes every file once its GET is done
+ */
+void fdcache_init(size_t max_files);
+
+/**
+ * @brief Returns the open file `name` of the share (relative to the current directory), opening it if needed.
+ * @return an entry to give back with fdcache_release, or NULL with errno set if it could not be opened
+ */
+fdcache_entry* fdcache_open(const char* name);
+
+int fdcache_fd(const fdcache_entry* entry);
+
+/**
+ * @brief Returns the result of fstat() when the file was opened.
+ */
+const struct stat* fdcache_stat(const fdcache_entry* entry);
+
+void fdcache_release(fdcache_entry* entry);
+
+/**
+ * @brief Closes `name` once nobody uses it anymore. Call whenever the file is replaced, changed or removed.
+ */
+void fdcache_invalidate(const char* name);
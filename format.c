@@ -15,9 +15,14 @@ const char *err_bad_file_size = "Bad file size\n";
 // existent file
 const char *err_no_such_file = "No such file\n";
 
+// Error message sent by the server when it is handling as many requests as it
+// may, a format taking the milliseconds the client should wait before trying
+// again
+const char *err_busy = "Busy, retry after %u ms\n";
+
 void print_client_usage() {
     printf("./client <host>:<port> <method> [remote] [local]\n \
-        <host>\t\tAddress to conenct to.\n \
+        <host>\t\tAddress to conenct to, or unix to use the Unix domain socket given as <port>.\n \
         <port>\t\tPort to set up connection on.\n \
         <method>\tMethod of request to send.\n \
         [remote]\tOptional argument refering to remote filename\n \
@@ -29,6 +34,7 @@ void print_client_help() {
     print_client_usage();
     printf("Methods:\n \
         LIST\t\t\tRequests a list of files on the server.\n \
+        LIST_ALL\t\tRequests a list of files gathered from every sub-server.\n \
         PUT <remote> <local>\tUploads <local> file to serve as filename <remote>.\n \
         GET <remote> <local>\tDownloads file named <remote> from server as filename <local>.\n \
         DELETE <remote>\tDeletes file named <remote> on server.\n");
@@ -54,6 +60,10 @@ void print_too_little_data() {
     printf("Received too little data\n");
 }
 
+void print_partial_listing(size_t answered, size_t queried) {
+    printf("Partial listing: only %zu of %zu sub-servers answered\n", answered, queried);
+}
+
 void print_success() {
     printf("DELETE/PUT successful\n");
 }
@@ -63,5 +73,40 @@ void print_temp_directory(char *temp_directory) {
 }
 
 void print_server_usage(void) {
-    fprintf(stderr, "./server <port>\n");
+    fprintf(stderr, "./server [options] <port>\n \
+        --rebalance-rate=<bytes/s>\tBandwidth used to move files onto new sub-servers, 0 disables (default 1048576)\n \
+        --list-deadline=<ms>\t\tHow long LIST_ALL waits for sub-servers (default 2000)\n \
+        --main=<host>:<port>\t\tRun as a sub-server and keep this main server's catalog in sync\n \
+        --advertise=<ip>\t\tAddress the main server redirects clients to (default: the one it sees us connect from)\n \
+        --scan-threads=<n>\t\tThreads used to stat files at startup when the file system does not report their type (default 4)\n \
+        --snapshot-interval=<s>\tSeconds between saves of the catalog to Pi-Share.catalog, 0 only saves on shutdown (default 60)\n \
+        --migrate=hashed|flat\t\tMove the files in Pi-Share into 65536 hashed subdirectories or back, then exit\n \
+        --pack-threshold=<bytes>\tStore uploads of at most this size in append-only pack files (default 0, off)\n \
+        --dedup\t\t\tStore identical uploads once and let clients skip sending contents we already have\n \
+        --store-compressed\t\tKeep uploads that arrive compressed compressed on disk\n \
+        --cache-size=<bytes>\t\tMemory used to keep frequently downloaded small files (default 0, off)\n \
+        --fd-cache=<n>\t\t\tFiles kept open between GETs, 0 closes them right away (default 128)\n \
+        --pull-after=<n>\t\tKeep a copy of sub-server files after this many redirects within a minute (default 0, off)\n \
+        --pull-cache-size=<bytes>\tSpace those copies may take up (default 268435456)\n \
+        --io-uring\t\t\tWrite uploads to disk through io_uring instead of blocking the server on each write\n \
+        --disk-threads=<n>\t\tThreads opening, storing and deleting files, 0 does it on the server thread (default 4)\n \
+        --header-timeout=<s>\t\tSeconds a client gets to send its request, 0 waits forever (default 10)\n \
+        --transfer-timeout=<s>\tSeconds a request may go without progress before it is dropped (default 30)\n \
+        --idle-timeout=<s>\t\tSeconds a sub-server's SYNC connection may stay silent (default 60)\n \
+        --quantum=<bytes>\t\tBytes a transfer moves before other clients get their turn, 0 for no limit (default 262144)\n \
+        --bulk-size=<bytes>\t\tTransfers larger than this get a quarter of the turn of smaller ones, 0 treats all alike (default 1048576)\n \
+        --rate-limit=<bytes/s>\t\tBandwidth of all transfers together (default 0, no limit)\n \
+        --get-rate-limit=<bytes/s>\tBandwidth of all GETs together (default 0, no limit)\n \
+        --put-rate-limit=<bytes/s>\tBandwidth of all PUTs together (default 0, no limit)\n \
+        --client-rate-limit=<bytes/s>\tBandwidth of each client address (default 0, no limit)\n \
+        --backlog=<n>\t\t\tConnections waiting to be accepted (default 128)\n \
+        --max-connections=<n>\t\tConnections open at once (default 0, no limit)\n \
+        --max-requests=<n>\t\tRequests handled at once (default 0, no limit)\n \
+        --max-gets=<n>\t\t\tGETs handled at once (default 0, no limit)\n \
+        --max-puts=<n>\t\t\tPUTs handled at once (default 0, no limit)\n \
+        --retry-after=<ms>\t\tHow long clients over a limit are asked to wait (default 1000)\n \
+        --defer-accept=<s>\t\tHand over connections only once their request arrived, waiting at most this long (default 0, off)\n \
+        --send-buffer=<bytes>\t\tSO_SNDBUF of client connections (default 0, sized by the kernel)\n \
+        --receive-buffer=<bytes>\tSO_RCVBUF of client connections (default 0, sized by the kernel)\n \
+        --unix=<path>\t\t\tAlso listen on this Unix domain socket, for clients on the same host\n");
 }
@@ -17,6 +17,11 @@ extern const char *err_bad_file_size;
 // existent file
 extern const char *err_no_such_file;
 
+// Error message sent by the server when it is handling as many requests as it
+// may, a format taking the milliseconds the client should wait before trying
+// again
+extern const char *err_busy;
+
 /**
  * Used in client.c in the event that command line arguments are missing or
  * trivially wrong; prints basic usage information.
@@ -63,6 +68,12 @@ void print_too_little_data(void);
  */
 void print_received_too_much_data(void);
 
+/**
+ * Use this function in client.c when a LIST_ALL response only contains the
+ * files of `answered` out of `queried` sub-servers.
+ */
+void print_partial_listing(size_t answered, size_t queried);
+
 /**
  * Use this function in client.c if the server successfully fulfilled a PUT or
  * DELETE request.
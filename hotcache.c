@@ -0,0 +1,267 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hotcache.h"
+#include "includes/dictionary.h"
+
+#define HOTCACHE_MAX_FREQ 3
+#define HOTCACHE_MIN_GHOSTS 64
+
+typedef enum { SMALL, MAIN, GHOST } queue_id;
+
+struct hotcache_entry {
+    char* name;
+    char* data; // NULL for ghosts
+    size_t size;
+    bool compressible;
+    unsigned freq; // Reads since the entry was last looked at by eviction, up to HOTCACHE_MAX_FREQ
+    unsigned refs; // The cache's own reference plus one per hotcache_get or hotcache_fill
+    queue_id queue;
+    hotcache_entry* prev; // Towards the head (the end entries are evicted from)
+    hotcache_entry* next;
+};
+
+typedef struct {
+    hotcache_entry* head;
+    hotcache_entry* tail;
+    size_t bytes;
+    size_t count;
+} fifo;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t capacity;
+static dictionary* entries; // name -> hotcache_entry*, for all three queues
+static fifo queues[3];
+static unsigned long invalidations; // Counts hotcache_invalidate calls, to notice one while reading a file
+
+static void push_tail(const queue_id id, hotcache_entry* e) {
+    fifo* q = &queues[id];
+    e->queue = id;
+    e->next = NULL;
+    e->prev = q->tail;
+    if (q->tail != NULL) {
+        q->tail->next = e;
+    } else {
+        q->head = e;
+    }
+    q->tail = e;
+    q->bytes += e->size;
+    ++q->count;
+}
+
+static hotcache_entry* unlink_entry(hotcache_entry* e) {
+    fifo* q = &queues[e->queue];
+    if (e->prev != NULL) {
+        e->prev->next = e->next;
+    } else {
+        q->head = e->next;
+    }
+    if (e->next != NULL) {
+        e->next->prev = e->prev;
+    } else {
+        q->tail = e->prev;
+    }
+    q->bytes -= e->size;
+    --q->count;
+    return e;
+}
+
+static void drop_ref(hotcache_entry* e) {
+    if (--e->refs == 0) {
+        free(e->name);
+        free(e->data);
+        free(e);
+    }
+}
+
+/**
+ * @brief Removes `e` from the cache altogether.
+ */
+static void forget(hotcache_entry* e) {
+    unlink_entry(e);
+    dictionary_remove(entries, e->name);
+    drop_ref(e);
+}
+
+/**
+ * @brief Turns `e`, just evicted from the small queue, into a ghost that only remembers its name.
+ */
+static void make_ghost(hotcache_entry* e) {
+    unlink_entry(e);
+    if (e->refs > 1) {
+        /* Still being sent, the data has to stay with the old entry */
+        dictionary_remove(entries, e->name);
+        hotcache_entry* ghost = calloc(1, sizeof(hotcache_entry));
+        ghost->name = strdup(e->name);
+        ghost->refs = 1;
+        drop_ref(e);
+        e = ghost;
+        dictionary_set(entries, e->name, e);
+    } else {
+        free(e->data);
+        e->data = NULL;
+        e->size = 0;
+    }
+    push_tail(GHOST, e);
+    const size_t max_ghosts = queues[MAIN].count > HOTCACHE_MIN_GHOSTS ? queues[MAIN].count : HOTCACHE_MIN_GHOSTS;
+    while (queues[GHOST].count > max_ghosts) {
+        forget(queues[GHOST].head);
+    }
+}
+
+static void evict_main(void) {
+    while (queues[MAIN].head != NULL) {
+        hotcache_entry* e = queues[MAIN].head;
+        if (e->freq == 0) {
+            forget(e);
+            return;
+        }
+        /* Read since we last looked, gets another round */
+        --e->freq;
+        push_tail(MAIN, unlink_entry(e));
+    }
+}
+
+static void evict_small(void) {
+    hotcache_entry* e = queues[SMALL].head;
+    if (e->freq > 0) {
+        /* Read again while in the small queue, so it is not a one-off */
+        unlink_entry(e);
+        e->freq = 0;
+        push_tail(MAIN, e);
+    } else {
+        make_ghost(e);
+    }
+}
+
+/**
+ * @brief Evicts entries until `incoming` more bytes fit.
+ */
+static void make_room(const size_t incoming) {
+    const size_t small_capacity = capacity * HOTCACHE_SMALL_SHARE / 100;
+    while (queues[SMALL].bytes + queues[MAIN].bytes + incoming > capacity &&
+           (queues[SMALL].head != NULL || queues[MAIN].head != NULL)) {
+        if (queues[SMALL].head != NULL && (queues[SMALL].bytes >= small_capacity || queues[MAIN].head == NULL)) {
+            evict_small();
+        } else {
+            evict_main();
+        }
+    }
+}
+
+void hotcache_init(const size_t bytes) {
+    capacity = bytes;
+    entries = dictionary_create(string_hash_function, string_compare, NULL, NULL, NULL, NULL);
+}
+
+bool hotcache_wants(const size_t size) {
+    return capacity > 0 && size <= HOTCACHE_MAX_FILE && size <= capacity;
+}
+
+hotcache_entry* hotcache_get(const char* name) {
+    if (capacity == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&lock);
+    hotcache_entry* e = dictionary_contains(entries, (void*)name) ? dictionary_get(entries, (void*)name) : NULL;
+    if (e != NULL && e->queue == GHOST) {
+        e = NULL;
+    }
+    if (e != NULL) {
+        if (e->freq < HOTCACHE_MAX_FREQ) {
+            ++e->freq;
+        }
+        ++e->refs;
+    }
+    pthread_mutex_unlock(&lock);
+    return e;
+}
+
+unsigned long hotcache_generation(void) {
+    pthread_mutex_lock(&lock);
+    const unsigned long generation = invalidations;
+    pthread_mutex_unlock(&lock);
+    return generation;
+}
+
+hotcache_entry* hotcache_fill(const char* name, const int fd, const off_t offset, const size_t size,
+                              const bool compressible, const unsigned long generation) {
+    if (!hotcache_wants(size)) {
+        return NULL;
+    }
+    char* data = malloc(size > 0 ? size : 1);
+    if (pread(fd, data, size, offset) != (ssize_t)size) {
+        free(data);
+        return NULL;
+    }
+    pthread_mutex_lock(&lock);
+    if (invalidations != generation) {
+        /* The file may have changed since it was opened, send what we read this once but do not keep it */
+        pthread_mutex_unlock(&lock);
+        hotcache_entry* e = calloc(1, sizeof(hotcache_entry));
+        e->name = strdup(name);
+        e->data = data;
+        e->size = size;
+        e->compressible = compressible;
+        e->refs = 1;
+        return e;
+    }
+    hotcache_entry* e = NULL;
+    bool seen_before = false;
+    if (dictionary_contains(entries, (void*)name)) {
+        e = dictionary_get(entries, (void*)name);
+        seen_before = e->queue == GHOST;
+        forget(e);
+    }
+    make_room(size);
+    e = calloc(1, sizeof(hotcache_entry));
+    e->name = strdup(name);
+    e->data = data;
+    e->size = size;
+    e->compressible = compressible;
+    e->refs = 2; /* The cache's and the caller's */
+    /* Files that fell out of the small queue not long ago are known to be read more than once */
+    push_tail(seen_before ? MAIN : SMALL, e);
+    dictionary_set(entries, e->name, e);
+    pthread_mutex_unlock(&lock);
+    return e;
+}
+
+const char* hotcache_data(const hotcache_entry* entry) {
+    return entry->data;
+}
+
+size_t hotcache_size(const hotcache_entry* entry) {
+    return entry->size;
+}
+
+bool hotcache_compressible(const hotcache_entry* entry) {
+    return entry->compressible;
+}
+
+void hotcache_release(hotcache_entry* entry) {
+    pthread_mutex_lock(&lock);
+    drop_ref(entry);
+    pthread_mutex_unlock(&lock);
+}
+
+void hotcache_invalidate(const char* name) {
+    if (capacity == 0) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    ++invalidations;
+    if (dictionary_contains(entries, (void*)name)) {
+        hotcache_entry* e = dictionary_get(entries, (void*)name);
+        if (e->queue != GHOST) {
+            forget(e);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,68 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Keeps the contents of frequently downloaded small files in memory, so a GET of one of them is answered without
+ * touching the file system.
+ *
+ * Entries are managed with S3-FIFO: new files go to a small FIFO queue and only move on to the main queue if they
+ * are read again before they reach its end, so a one-off sweep over many files does not push out the hot ones.
+ * Files evicted from the small queue are remembered by name for a while and go straight to the main queue if they
+ * come back. The main queue gives every entry that was read since it was last looked at another round.
+ *
+ * Entries are reference counted, so one can keep being sent after it was evicted or invalidated.
+ */
+#define HOTCACHE_MAX_FILE (1024 * 1024) // Larger files are never cached
+#define HOTCACHE_SMALL_SHARE 10 // Percent of the capacity used by the small queue
+
+typedef struct hotcache_entry hotcache_entry;
+
+/**
+ * @param capacity bytes of file contents kept at most, 0 disables the cache
+ */
+void hotcache_init(size_t capacity);
+
+/**
+ * @brief Checks whether files of `size` bytes are cached at all.
+ */
+bool hotcache_wants(size_t size);
+
+/**
+ * @brief Looks up `name`, counting the access.
+ * @return the entry with a reference the caller has to give back with hotcache_release, or NULL if not cached
+ */
+hotcache_entry* hotcache_get(const char* name);
+
+/**
+ * @brief Counts hotcache_invalidate calls. Take it before opening a file that may go to hotcache_fill.
+ */
+unsigned long hotcache_generation(void);
+
+/**
+ * @brief Reads the `size` bytes of `fd` starting at `offset` as the contents of `name` and caches them.
+ * @param compressible whether the contents are worth compressing for clients that take compressed contents
+ * @param generation hotcache_generation from before `fd` was opened. If anything was invalidated since, the entry
+ * is handed out but not kept, as `fd` may hold contents that were replaced meanwhile.
+ * @return the new entry with a reference (see hotcache_get), or NULL if it could not be read or is too large
+ */
+hotcache_entry* hotcache_fill(const char* name, int fd, off_t offset, size_t size, bool compressible,
+                              unsigned long generation);
+
+const char* hotcache_data(const hotcache_entry* entry);
+
+size_t hotcache_size(const hotcache_entry* entry);
+
+bool hotcache_compressible(const hotcache_entry* entry);
+
+void hotcache_release(hotcache_entry* entry);
+
+/**
+ * @brief Forgets `name`. Call whenever the contents of a local file change or it stops being local.
+ */
+void hotcache_invalidate(const char* name);
@@ -0,0 +1,205 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "layout.h"
+
+static bool hashed = false;
+
+/**
+ * @brief FNV-1a, picked for being short and spreading similar names well.
+ */
+static uint32_t hash_name(const char* name) {
+    uint32_t h = 2166136261u;
+    for (; *name != '\0'; ++name) {
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    }
+    return h;
+}
+
+#define LAYOUT_DIR_NEW LAYOUT_DIR ".new" // Where the subdirectories are prepared before the share becomes hashed
+#define LAYOUT_DIR_OLD LAYOUT_DIR ".old" // Where they are removed from after the share became flat again
+
+static bool is_marker(const char* name) {
+    return strncmp(name, LAYOUT_DIR, strlen(LAYOUT_DIR)) == 0;
+}
+
+void layout_init(const char* dir) {
+    char marker[1024];
+    snprintf(marker, sizeof(marker), "%s/%s", dir, LAYOUT_DIR);
+    struct stat s;
+    hashed = stat(marker, &s) == 0 && S_ISDIR(s.st_mode);
+}
+
+bool layout_hashed(void) {
+    return hashed;
+}
+
+const char* layout_path(const char* name, char* buffer) {
+    if (!hashed) {
+        return name;
+    }
+    const uint32_t h = hash_name(name);
+    snprintf(buffer, LAYOUT_PATH_MAX, LAYOUT_DIR "/%02x/%02x/%s", h % LAYOUT_FANOUT, h / LAYOUT_FANOUT % LAYOUT_FANOUT,
+             name);
+    return buffer;
+}
+
+bool layout_ingest(const int dir_fd, const char* name) {
+    if (!hashed || is_marker(name)) {
+        return false;
+    }
+    char buffer[LAYOUT_PATH_MAX];
+    return renameat(dir_fd, name, dir_fd, layout_path(name, buffer)) == 0;
+}
+
+/**
+ * @brief Calls `move` on every regular file directly inside `dir`.
+ * @return the number of calls that returned true, or -1 if `dir` could not be read
+ */
+static long for_each_top_level_file(const char* dir, bool (*move)(int dir_fd, const char* name)) {
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        return -1;
+    }
+    const int dir_fd = dirfd(d);
+    long moved = 0;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        struct stat s;
+        if (is_marker(entry->d_name) || fstatat(dir_fd, entry->d_name, &s, AT_SYMLINK_NOFOLLOW) == -1 ||
+            !S_ISREG(s.st_mode)) {
+            continue;
+        }
+        if (move(dir_fd, entry->d_name)) {
+            ++moved;
+        }
+    }
+    closedir(d);
+    return moved;
+}
+
+long layout_ingest_all(const char* dir) {
+    if (!hashed) {
+        return 0;
+    }
+    const long moved = for_each_top_level_file(dir, layout_ingest);
+    if (moved > 0) {
+        LOG("layout: moved %ld files found directly in %s into place", moved, dir);
+    }
+    return moved;
+}
+
+/**
+ * @brief Creates `base` and the subdirectories of the hashed layout inside it that do not exist yet.
+ */
+static bool make_subdirectories(const int dir_fd, const char* base) {
+    char path[64];
+    if (mkdirat(dir_fd, base, 0777) == -1 && errno != EEXIST) {
+        perror(base);
+        return false;
+    }
+    for (int i = 0; i < LAYOUT_FANOUT; ++i) {
+        snprintf(path, sizeof(path), "%s/%02x", base, i);
+        if (mkdirat(dir_fd, path, 0777) == -1 && errno != EEXIST) {
+            perror(path);
+            return false;
+        }
+        for (int j = 0; j < LAYOUT_FANOUT; ++j) {
+            snprintf(path, sizeof(path), "%s/%02x/%02x", base, i, j);
+            if (mkdirat(dir_fd, path, 0777) == -1 && errno != EEXIST) {
+                perror(path);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Moves every file of the hashed layout up into the share directory.
+ */
+static bool flatten(const int dir_fd) {
+    char path[64];
+    bool ok = true;
+    for (int i = 0; i < LAYOUT_FANOUT * LAYOUT_FANOUT; ++i) {
+        snprintf(path, sizeof(path), LAYOUT_DIR "/%02x/%02x", i / LAYOUT_FANOUT, i % LAYOUT_FANOUT);
+        const int sub_fd = openat(dir_fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sub_fd == -1) {
+            continue;
+        }
+        DIR* d = fdopendir(sub_fd);
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            if (renameat(sub_fd, entry->d_name, dir_fd, entry->d_name) == -1) {
+                fprintf(stderr, "moving %s/%s: %s\n", path, entry->d_name, strerror(errno));
+                ok = false;
+            }
+        }
+        closedir(d);
+    }
+    return ok;
+}
+
+static void remove_subdirectories(const int dir_fd, const char* base) {
+    char path[64];
+    for (int i = 0; i < LAYOUT_FANOUT; ++i) {
+        for (int j = 0; j < LAYOUT_FANOUT; ++j) {
+            snprintf(path, sizeof(path), "%s/%02x/%02x", base, i, j);
+            unlinkat(dir_fd, path, AT_REMOVEDIR);
+        }
+        snprintf(path, sizeof(path), "%s/%02x", base, i);
+        unlinkat(dir_fd, path, AT_REMOVEDIR);
+    }
+    unlinkat(dir_fd, base, AT_REMOVEDIR);
+}
+
+int layout_migrate(const char* dir, const bool to_hashed) {
+    const int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        perror(dir);
+        return 1;
+    }
+    layout_init(dir);
+    bool ok = true;
+    if (to_hashed) {
+        /*
+         * The subdirectories are prepared under another name and renamed into place, so the share becomes hashed in
+         * one step. From then on the server moves any file still lying directly in it into place on startup.
+         */
+        if (!hashed) {
+            ok = make_subdirectories(dir_fd, LAYOUT_DIR_NEW) && renameat(dir_fd, LAYOUT_DIR_NEW, dir_fd, LAYOUT_DIR) == 0;
+        }
+        if (ok) {
+            hashed = true;
+            ok = layout_ingest_all(dir) >= 0;
+        }
+    } else if (hashed) {
+        /* The share stays hashed until LAYOUT_DIR is gone, so files moved up so far are moved back on startup */
+        ok = flatten(dir_fd) && renameat(dir_fd, LAYOUT_DIR, dir_fd, LAYOUT_DIR_OLD) == 0;
+    }
+    if (ok && !to_hashed) {
+        hashed = false;
+        remove_subdirectories(dir_fd, LAYOUT_DIR_OLD);
+    }
+    close(dir_fd);
+    if (!ok) {
+        fprintf(stderr, "Migrating %s failed, run the migration again\n", dir);
+        return 1;
+    }
+    printf("%s now uses the %s layout\n", dir, to_hashed ? "hashed" : "flat");
+    return 0;
+}
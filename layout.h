@@ -0,0 +1,52 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+
+/**
+ * How files are laid out inside Pi-Share.
+ *
+ * Flat (the default): every file is stored directly in Pi-Share under its own name.
+ * Hashed: a file is stored in Pi-Share/LAYOUT_DIR/<xx>/<yy>/<name>, where xx and yy are the two low bytes of a hash
+ * of the name in hex, so no directory grows past a few entries per 65536 files. The share is hashed exactly when
+ * LAYOUT_DIR exists, and regular files found directly in Pi-Share are moved into place (see layout_ingest).
+ *
+ * A share is converted from one layout to the other with `./server --migrate=hashed|flat`.
+ */
+#define LAYOUT_DIR ".pi-share-hashed"
+#define LAYOUT_FANOUT 256 // Subdirectories per level
+#define LAYOUT_PATH_MAX 1060 // Longest path layout_path returns, for the longest file name a header can hold
+
+/**
+ * @brief Reads the layout of the share directory `dir`. Call before anything else in this file.
+ */
+void layout_init(const char* dir);
+
+bool layout_hashed(void);
+
+/**
+ * @brief Returns where `name` is stored, relative to the share directory.
+ * @param buffer LAYOUT_PATH_MAX bytes the path is written to if it differs from `name`
+ */
+const char* layout_path(const char* name, char* buffer);
+
+/**
+ * @brief Moves the file `name` found directly in the share directory `dir_fd` to where the hashed layout keeps it.
+ * @return true if it was moved
+ */
+bool layout_ingest(int dir_fd, const char* name);
+
+/**
+ * @brief Moves every regular file found directly in the share directory `dir` into place. Does nothing when flat.
+ * @return the number of files moved
+ */
+long layout_ingest_all(const char* dir);
+
+/**
+ * @brief Converts the share directory `dir` to the hashed or the flat layout, moving every file.
+ * Safe to interrupt and run again: the server can use the share at every step, in one layout or the other.
+ * @return 0 on success, 1 on failure, like a process exit status
+ */
+int layout_migrate(const char* dir, bool hashed);
@@ -0,0 +1,140 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "location_cache.h"
+#include "includes/dictionary.h"
+
+/*
+ * On disk, every entry is a single line:
+ *   <expires:epoch seconds> <main host>:<main port> <ip> <port> <remote file>\n
+ * The remote file name goes last since it is the only field that may contain spaces.
+ */
+
+static dictionary* entries; // remote file -> "<expires> <ip> <port>" for the current main server
+static vector* foreign_lines; // entries of other main servers, written back verbatim
+static char* main_server;
+static char* cache_path;
+static long ttl = LOCATION_CACHE_DEFAULT_TTL;
+static bool dirty = false;
+
+void location_cache_load(const char* main_host, const char* main_port) {
+    const char* ttl_env = getenv(LOCATION_CACHE_TTL_ENV);
+    if (ttl_env != NULL) {
+        ttl = strtol(ttl_env, NULL, 10);
+    }
+    if (ttl <= 0) {
+        return; /* Caching is disabled, every lookup misses and nothing is written */
+    }
+    const char* path_env = getenv(LOCATION_CACHE_PATH_ENV);
+    cache_path = strdup(path_env != NULL ? path_env : LOCATION_CACHE_DEFAULT_PATH);
+    asprintf(&main_server, "%s:%s", main_host, main_port);
+    entries = string_to_string_dictionary_create();
+    foreign_lines = string_vector_create();
+
+    FILE* f = fopen(cache_path, "r");
+    if (f == NULL) {
+        return;
+    }
+    const time_t now = time(NULL);
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &line_cap, f)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        long expires;
+        char server[128], ip[64], port[32];
+        int name_offset = 0;
+        if (sscanf(line, "%ld %127s %63s %31s %n", &expires, server, ip, port, &name_offset) != 4 ||
+            name_offset == 0 || line[name_offset] == '\0' || expires <= now) {
+            dirty = true; /* Drop expired or corrupt entries on the next save */
+            continue;
+        }
+        if (strcmp(server, main_server) != 0) {
+            vector_push_back(foreign_lines, line);
+            continue;
+        }
+        char value[128];
+        snprintf(value, sizeof(value), "%ld %s %s", expires, ip, port);
+        dictionary_set(entries, line + name_offset, value);
+    }
+    free(line);
+    fclose(f);
+}
+
+bool location_cache_lookup(const char* remote_file, char* ip, char* port, const size_t size) {
+    if (entries == NULL || !dictionary_contains(entries, (void*)remote_file)) {
+        return false;
+    }
+    long expires;
+    char cached_ip[64], cached_port[32];
+    const char* value = dictionary_get(entries, (void*)remote_file);
+    if (sscanf(value, "%ld %63s %31s", &expires, cached_ip, cached_port) != 3 || expires <= time(NULL)) {
+        location_cache_invalidate(remote_file);
+        return false;
+    }
+    snprintf(ip, size, "%s", cached_ip);
+    snprintf(port, size, "%s", cached_port);
+    return true;
+}
+
+void location_cache_store(const char* remote_file, const char* ip, const char* port) {
+    if (entries == NULL) {
+        return;
+    }
+    char value[128];
+    snprintf(value, sizeof(value), "%ld %s %s", (long)(time(NULL) + ttl), ip, port);
+    dictionary_set(entries, (void*)remote_file, value);
+    dirty = true;
+}
+
+void location_cache_invalidate(const char* remote_file) {
+    if (entries == NULL || !dictionary_contains(entries, (void*)remote_file)) {
+        return;
+    }
+    dictionary_remove(entries, (void*)remote_file);
+    dirty = true;
+}
+
+void location_cache_save(void) {
+    if (entries == NULL) {
+        return;
+    }
+    if (dirty) {
+        char* tmp_path;
+        asprintf(&tmp_path, "%s.%d", cache_path, getpid());
+        FILE* f = fopen(tmp_path, "w");
+        if (f != NULL) {
+            VECTOR_FOR_EACH(foreign_lines, line, fprintf(f, "%s\n", (char*)line););
+            vector* keys = dictionary_keys(entries);
+            for (size_t i = 0; i < vector_size(keys); ++i) {
+                char* name = vector_get(keys, i);
+                long expires;
+                char ip[64], port[32];
+                if (sscanf(dictionary_get(entries, name), "%ld %63s %31s", &expires, ip, port) == 3) {
+                    fprintf(f, "%ld %s %s %s %s\n", expires, main_server, ip, port, name);
+                }
+            }
+            vector_destroy(keys);
+            if (fclose(f) == 0) {
+                rename(tmp_path, cache_path);
+            } else {
+                unlink(tmp_path);
+            }
+        }
+        free(tmp_path);
+    }
+    dictionary_destroy(entries);
+    vector_destroy(foreign_lines);
+    free(main_server);
+    free(cache_path);
+    entries = NULL;
+}
@@ -0,0 +1,46 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Environment variable overriding where the location cache is persisted
+#define LOCATION_CACHE_PATH_ENV "PI_SHARE_LOCATION_CACHE"
+// Environment variable overriding how long (in seconds) an entry stays valid, 0 disables the cache
+#define LOCATION_CACHE_TTL_ENV "PI_SHARE_LOCATION_TTL"
+
+#define LOCATION_CACHE_DEFAULT_PATH ".pi-share-locations"
+#define LOCATION_CACHE_DEFAULT_TTL 300
+
+/**
+ * @brief Loads the persistent file -> sub-server cache for the main server at `main_host`:`main_port`.
+ * Entries belonging to other main servers are kept around untouched so they survive the next save.
+ * Expired entries are dropped while loading.
+ */
+void location_cache_load(const char* main_host, const char* main_port);
+
+/**
+ * @brief Looks up the sub-server that holds `remote_file`.
+ * @param ip buffer of at least `size` bytes that receives the sub-server ip
+ * @param port buffer of at least `size` bytes that receives the sub-server port
+ * @return true if there is an unexpired entry for `remote_file`
+ */
+bool location_cache_lookup(const char* remote_file, char* ip, char* port, size_t size);
+
+/**
+ * @brief Remembers that `remote_file` lives on `ip`:`port` for the configured TTL.
+ */
+void location_cache_store(const char* remote_file, const char* ip, const char* port);
+
+/**
+ * @brief Forgets any entry for `remote_file`, used when the cached sub-server could not serve it.
+ */
+void location_cache_invalidate(const char* remote_file);
+
+/**
+ * @brief Writes the cache back to disk if it changed and releases it.
+ * The file is replaced atomically, so concurrent clients never see a torn cache.
+ */
+void location_cache_save(void);
@@ -0,0 +1,423 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "pack.h"
+#include "includes/dictionary.h"
+
+#define PACK_MAGIC 0x314b4350u // "PCK1"
+#define PACK_FILE 'F'
+#define PACK_TOMBSTONE 'T'
+#define PACK_MAX_NAME 1024
+
+typedef struct {
+    uint32_t magic;
+    uint16_t name_len;
+    char type;
+    char pad;
+    uint64_t seq;
+    uint64_t data_len;
+} record_header;
+
+typedef struct {
+    uint32_t segment;
+    uint64_t record; // Offset of the record header in the segment
+    uint64_t length; // Length of the whole record
+    uint64_t data; // Offset of the contents in the segment
+    uint64_t size; // Length of the contents
+    uint64_t seq;
+} pack_entry;
+
+typedef struct {
+    int fd; // -1 if there is no such segment (anymore)
+    uint64_t end; // Where the next record goes
+    uint64_t live; // Bytes taken by records of the current version of a file
+} segment;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int packs_fd = -1;
+static size_t max_packed_size;
+static dictionary* entries; // Maps file name -> pack_entry*
+static segment* segments; // Indexed by segment number
+static uint32_t segment_count;
+static uint32_t active; // The segment new records are appended to, segment_count if none yet
+static uint64_t next_seq = 1;
+
+static void* pack_entry_copy_constructor(void* p) {
+    pack_entry* copy = malloc(sizeof(pack_entry));
+    *copy = *(pack_entry*)p;
+    return copy;
+}
+
+/**
+ * @brief Returns the index entry of `name`, or NULL if it is not packed. Call with the lock held.
+ */
+static pack_entry* lookup(const char* name) {
+    if (entries == NULL || !dictionary_contains(entries, (void*)name)) {
+        return NULL;
+    }
+    return dictionary_get(entries, (void*)name);
+}
+
+static void segment_name(const uint32_t number, char* buffer, const size_t size) {
+    snprintf(buffer, size, "%08u.pack", number);
+}
+
+static void ensure_segments(const uint32_t count) {
+    if (count <= segment_count) {
+        return;
+    }
+    segments = realloc(segments, count * sizeof(segment));
+    for (uint32_t i = segment_count; i < count; ++i) {
+        segments[i] = (segment){-1, 0, 0};
+    }
+    segment_count = count;
+}
+
+/**
+ * @brief Makes `e` the current version of `name`, and keeps track of how much of each segment is live.
+ */
+static void set_entry(const char* name, const pack_entry* e) {
+    pack_entry* old = lookup(name);
+    if (old != NULL) {
+        segments[old->segment].live -= old->length;
+    }
+    segments[e->segment].live += e->length;
+    dictionary_set(entries, (void*)name, (void*)e);
+}
+
+static void remove_entry(const char* name) {
+    pack_entry* old = lookup(name);
+    if (old != NULL) {
+        segments[old->segment].live -= old->length;
+        dictionary_remove(entries, (void*)name);
+    }
+}
+
+/**
+ * @brief Appends a record to the active segment, starting a new one when it is full. Call with the lock held.
+ * @param out if not NULL, receives where the record went
+ */
+static bool append_record(const char type, const char* name, const void* data, const size_t size,
+                          const uint64_t seq, pack_entry* out) {
+    const size_t name_len = strlen(name);
+    const uint64_t length = sizeof(record_header) + name_len + size;
+    if (active >= segment_count || (segments[active].end > 0 && segments[active].end + length > PACK_SEGMENT_SIZE)) {
+        char file_name[32];
+        segment_name(segment_count, file_name, sizeof(file_name));
+        const int fd = openat(packs_fd, file_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            perror("creating a pack segment failed");
+            return false;
+        }
+        active = segment_count;
+        ensure_segments(segment_count + 1);
+        segments[active].fd = fd;
+    }
+    segment* seg = &segments[active];
+    const record_header header = {PACK_MAGIC, (uint16_t)name_len, type, 0, seq, size};
+    struct iovec iov[3] = {
+        {(void*)&header, sizeof(header)},
+        {(void*)name, name_len},
+        {(void*)data, size}
+    };
+    if (pwritev(seg->fd, iov, size > 0 ? 3 : 2, (off_t)seg->end) != (ssize_t)length) {
+        perror("writing a pack record failed");
+        return false;
+    }
+    if (out != NULL) {
+        *out = (pack_entry){active, seg->end, length, seg->end + sizeof(header) + name_len, size, seq};
+    }
+    seg->end += length;
+    return true;
+}
+
+/**
+ * @brief Reads the record headers of segment `number` into the index.
+ * @param tombstones maps names to the sequence number of their latest deletion seen so far
+ */
+static void load_segment(const uint32_t number, dictionary* tombstones) {
+    segment* seg = &segments[number];
+    struct stat s;
+    if (fstat(seg->fd, &s) == -1) {
+        return;
+    }
+    const uint64_t file_size = s.st_size;
+    uint64_t pos = 0;
+    record_header header;
+    char name[PACK_MAX_NAME + 1];
+    while (pos + sizeof(header) <= file_size) {
+        if (pread(seg->fd, &header, sizeof(header), (off_t)pos) != sizeof(header) || header.magic != PACK_MAGIC ||
+            header.name_len == 0 || header.name_len > PACK_MAX_NAME ||
+            pos + sizeof(header) + header.name_len + header.data_len > file_size ||
+            pread(seg->fd, name, header.name_len, (off_t)(pos + sizeof(header))) != header.name_len) {
+            break;
+        }
+        name[header.name_len] = '\0';
+        const pack_entry e = {number, pos, sizeof(header) + header.name_len + header.data_len,
+                              pos + sizeof(header) + header.name_len, header.data_len, header.seq};
+        const pack_entry* current = lookup(name);
+        const unsigned long* deleted = dictionary_contains(tombstones, name) ? dictionary_get(tombstones, name) : NULL;
+        if (header.type == PACK_FILE) {
+            if ((deleted == NULL || *deleted < header.seq) && (current == NULL || current->seq < header.seq)) {
+                set_entry(name, &e);
+            }
+        } else {
+            if (deleted == NULL || *deleted < header.seq) {
+                unsigned long seq = header.seq;
+                dictionary_set(tombstones, name, &seq);
+            }
+            if (current != NULL && current->seq < header.seq) {
+                remove_entry(name);
+            }
+        }
+        if (header.seq >= next_seq) {
+            next_seq = header.seq + 1;
+        }
+        pos += e.length;
+    }
+    if (pos < file_size) {
+        /* A record that was cut short by a crash, the next one goes in its place */
+        LOG("pack: ignoring %llu damaged bytes at the end of segment %u", (unsigned long long)(file_size - pos),
+            number);
+    }
+    seg->end = pos;
+}
+
+void pack_init(const char* dir, const size_t threshold) {
+    entries = dictionary_create(string_hash_function, string_compare, string_copy_constructor, free,
+                                pack_entry_copy_constructor, free);
+    max_packed_size = threshold;
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, PACK_DIR);
+    if (threshold > 0 && mkdir(path, 0777) == -1 && errno != EEXIST) {
+        perror("creating the pack directory failed");
+        max_packed_size = 0;
+    }
+    packs_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (packs_fd == -1) {
+        return; /* No packs, and we are not going to make any */
+    }
+
+    DIR* d = fdopendir(dup(packs_fd));
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        unsigned number;
+        char suffix[8];
+        if (sscanf(entry->d_name, "%u.%7s", &number, suffix) == 2 && strcmp(suffix, "pack") == 0) {
+            ensure_segments(number + 1);
+            segments[number].fd = openat(packs_fd, entry->d_name, O_RDWR | O_CLOEXEC);
+        }
+    }
+    closedir(d);
+
+    dictionary* tombstones = string_to_unsigned_long_dictionary_create();
+    for (uint32_t i = 0; i < segment_count; ++i) {
+        if (segments[i].fd != -1) {
+            load_segment(i, tombstones);
+        }
+    }
+    dictionary_destroy(tombstones);
+    /* Keep appending to the newest segment */
+    active = segment_count;
+    uint32_t present = 0;
+    for (uint32_t i = 0; i < segment_count; ++i) {
+        if (segments[i].fd != -1) {
+            active = i;
+            ++present;
+        }
+    }
+    if (dictionary_size(entries) > 0) {
+        LOG("pack: %zu files in %u segments", dictionary_size(entries), present);
+    }
+}
+
+bool pack_wants(const size_t size) {
+    return max_packed_size > 0 && size <= max_packed_size && packs_fd != -1;
+}
+
+bool pack_put(const char* name, const void* data, const size_t size) {
+    pthread_mutex_lock(&lock);
+    pack_entry e;
+    const bool ok = append_record(PACK_FILE, name, data, size, next_seq++, &e);
+    if (ok) {
+        set_entry(name, &e);
+    }
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+int pack_open(const char* name, off_t* offset, size_t* size) {
+    pthread_mutex_lock(&lock);
+    int fd = -1;
+    const pack_entry* e = lookup(name);
+    if (e != NULL) {
+        /* A descriptor of its own keeps the data readable even if compaction deletes the segment meanwhile */
+        fd = fcntl(segments[e->segment].fd, F_DUPFD_CLOEXEC, 0);
+        *offset = (off_t)e->data;
+        *size = e->size;
+    }
+    pthread_mutex_unlock(&lock);
+    return fd;
+}
+
+bool pack_contains(const char* name) {
+    return pack_version(name) != 0;
+}
+
+uint64_t pack_version(const char* name) {
+    pthread_mutex_lock(&lock);
+    const pack_entry* e = lookup(name);
+    const uint64_t version = e != NULL ? e->seq : 0;
+    pthread_mutex_unlock(&lock);
+    return version;
+}
+
+int pack_remove(const char* name) {
+    pthread_mutex_lock(&lock);
+    int result = 0;
+    if (entries != NULL && dictionary_contains(entries, (void*)name)) {
+        /* Without its tombstone the file would come back on the next start, so it stays until one is written */
+        result = append_record(PACK_TOMBSTONE, name, NULL, 0, next_seq++, NULL) ? 1 : -1;
+        if (result == 1) {
+            remove_entry(name);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+vector* pack_names(void) {
+    pthread_mutex_lock(&lock);
+    vector* names = entries != NULL ? dictionary_keys(entries) : string_vector_create();
+    pthread_mutex_unlock(&lock);
+    return names;
+}
+
+/**
+ * @return whether a segment numbered below `number` exists. Older versions of a file are only ever in the segment of
+ * its tombstone or below it: records are appended to the newest segment, and compaction only copies live files.
+ */
+static bool has_older_segment(const uint32_t number) {
+    for (uint32_t i = 0; i < number; ++i) {
+        if (segments[i].fd != -1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Copies the records of segment `number` that still matter to the active segment, then deletes it.
+ * Files are copied if they are the current version, deletions if no newer version of the file exists and an older
+ * one might still be in an older segment.
+ * @return false if it failed, in which case the segment is kept
+ */
+static bool compact_segment(const uint32_t number) {
+    pthread_mutex_lock(&lock);
+    const int fd = fcntl(segments[number].fd, F_DUPFD_CLOEXEC, 0);
+    const uint64_t end = segments[number].end;
+    const bool keep_tombstones = has_older_segment(number);
+    pthread_mutex_unlock(&lock);
+
+    /* The segment is sealed, so it can be read without the lock */
+    uint64_t pos = 0;
+    size_t copied = 0;
+    record_header header;
+    char name[PACK_MAX_NAME + 1];
+    char* data = NULL;
+    size_t data_cap = 0;
+    bool ok = true;
+    while (ok && pos < end) {
+        if (pread(fd, &header, sizeof(header), (off_t)pos) != sizeof(header) ||
+            pread(fd, name, header.name_len, (off_t)(pos + sizeof(header))) != header.name_len) {
+            ok = false;
+            break;
+        }
+        name[header.name_len] = '\0';
+        const uint64_t length = sizeof(header) + header.name_len + header.data_len;
+        if (header.data_len > data_cap) {
+            data_cap = header.data_len;
+            data = realloc(data, data_cap);
+        }
+
+        pthread_mutex_lock(&lock);
+        const pack_entry* current = lookup(name);
+        if (header.type == PACK_FILE && current != NULL && current->segment == number && current->record == pos) {
+            pack_entry e;
+            ok = pread(fd, data, header.data_len, (off_t)(pos + sizeof(header) + header.name_len)) ==
+                 (ssize_t)header.data_len &&
+                 append_record(PACK_FILE, name, data, header.data_len, header.seq, &e);
+            if (ok) {
+                set_entry(name, &e);
+                ++copied;
+            }
+        } else if (header.type == PACK_TOMBSTONE && keep_tombstones &&
+                   (current == NULL || current->seq < header.seq)) {
+            ok = append_record(PACK_TOMBSTONE, name, NULL, 0, header.seq, NULL);
+        }
+        pthread_mutex_unlock(&lock);
+        pos += length;
+    }
+    free(data);
+    close(fd);
+    if (!ok) {
+        LOG("pack: compacting segment %u failed, keeping it", number);
+        return false;
+    }
+
+    pthread_mutex_lock(&lock);
+    char file_name[32];
+    segment_name(number, file_name, sizeof(file_name));
+    unlinkat(packs_fd, file_name, 0);
+    close(segments[number].fd);
+    segments[number] = (segment){-1, 0, 0};
+    pthread_mutex_unlock(&lock);
+    LOG("pack: compacted segment %u, %zu files moved", number, copied);
+    return true;
+}
+
+static void* compaction_worker(void* arg) {
+    (void)arg;
+    while (true) {
+        sleep(PACK_COMPACT_INTERVAL);
+        /* Compact sealed segments that are mostly dead, one at a time */
+        while (true) {
+            pthread_mutex_lock(&lock);
+            uint32_t victim = segment_count;
+            for (uint32_t i = 0; i < segment_count; ++i) {
+                if (i != active && segments[i].fd != -1 && segments[i].live * 2 < segments[i].end) {
+                    victim = i;
+                    break;
+                }
+            }
+            pthread_mutex_unlock(&lock);
+            /* After a failure, like a full disk, try again next time instead of copying the same records again */
+            if (victim == segment_count || !compact_segment(victim)) {
+                break;
+            }
+        }
+    }
+    return NULL;
+}
+
+void pack_start_compaction(void) {
+    if (packs_fd == -1) {
+        return;
+    }
+    if (!spawn_detached(compaction_worker, NULL)) {
+        exit(1);
+    }
+}
@@ -0,0 +1,75 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "includes/vector.h"
+
+/**
+ * Small files can be stored in pack segments instead of one file each, saving an inode, a directory entry and a
+ * block per file. Segments live in Pi-Share/PACK_DIR and are only ever appended to:
+ *
+ *   record: <magic:uint32><name length:uint16><type:char><pad:char><seq:uint64><data length:uint64><name><data>
+ *
+ * `type` is PACK_FILE or PACK_TOMBSTONE (a deleted file, without data). Every record gets the next sequence number,
+ * and the record with the highest one wins, so the index is rebuilt by reading the record headers of all segments.
+ * Compaction copies what is still live out of mostly dead segments, keeping the sequence numbers, and deletes them.
+ * A packed file is a local file like any other for the catalog.
+ */
+#define PACK_DIR ".pi-share-packs"
+#define PACK_SEGMENT_SIZE (64 * 1024 * 1024) // A segment is sealed once it grows past this
+#define PACK_COMPACT_INTERVAL 30 // Seconds between looks for segments worth compacting
+
+/**
+ * @brief Loads the packs of the share directory `dir`.
+ * @param threshold PUTs of at most this many bytes go into packs, 0 never packs new files (existing packs are
+ * still served)
+ */
+void pack_init(const char* dir, size_t threshold);
+
+/**
+ * @brief Whether a PUT of `size` bytes should be stored with pack_put.
+ */
+bool pack_wants(size_t size);
+
+/**
+ * @brief Appends `name` with `size` bytes of `data`, replacing an earlier packed version.
+ * @return false if the write failed
+ */
+bool pack_put(const char* name, const void* data, size_t size);
+
+/**
+ * @brief Opens the packed file `name` for reading.
+ * @param offset receives where the contents start in the returned file
+ * @param size receives the length of the contents
+ * @return a new descriptor of the segment holding it (the caller closes it), or -1 if `name` is not packed
+ */
+int pack_open(const char* name, off_t* offset, size_t* size);
+
+bool pack_contains(const char* name);
+
+/**
+ * @return an identifier of the current version of `name` that changes whenever it is written, 0 if not packed
+ */
+uint64_t pack_version(const char* name);
+
+/**
+ * @brief Deletes the packed file `name`.
+ * @return 1 if it was deleted, 0 if `name` was not packed, -1 if the deletion could not be written (it stays packed)
+ */
+int pack_remove(const char* name);
+
+/**
+ * @brief Returns the names of all packed files, the caller has to vector_destroy it.
+ */
+vector* pack_names(void);
+
+/**
+ * @brief Starts the background thread that compacts segments.
+ */
+void pack_start_compaction(void);
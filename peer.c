@@ -0,0 +1,269 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compress.h"
+#include "peer.h"
+
+bool peer_write_all(const int sock, const void* data, const size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        const ssize_t res = write(sock, (const char*)data + written, size - written);
+        if (res <= 0) {
+            return false;
+        }
+        written += res;
+    }
+    return true;
+}
+
+bool peer_read_all(const int sock, void* buffer, const size_t size) {
+    size_t total = 0;
+    while (total < size) {
+        const ssize_t res = read(sock, (char*)buffer + total, size - total);
+        if (res <= 0) {
+            return false;
+        }
+        total += res;
+    }
+    return true;
+}
+
+static bool read_line(const int sock, char* buffer, const size_t size) {
+    size_t idx = 0;
+    while (idx < size - 1) {
+        if (read(sock, buffer + idx, 1) <= 0) return false;
+        if (buffer[idx] == '\n') break;
+        ++idx;
+    }
+    buffer[idx] = '\0';
+    return true;
+}
+
+static bool read_ok(const int sock) {
+    char header[3];
+    return peer_read_all(sock, header, sizeof(header)) && strncmp(header, "OK\n", sizeof(header)) == 0;
+}
+
+/**
+ * @brief Reads the `<ip>\n<port>\n` redirect lines sent in response to GET and PUT.
+ * @return true if the peer will handle the request itself (it sent 0.0.0.0)
+ */
+static bool read_no_redirect(const int sock) {
+    char ip[64];
+    char port[64];
+    return read_line(sock, ip, sizeof(ip)) && read_line(sock, port, sizeof(port)) && strcmp(ip, "0.0.0.0") == 0;
+}
+
+/**
+ * @brief Sleeps long enough that `transferred` bytes since `start` do not exceed `max_rate` bytes per second.
+ */
+static void throttle(const struct timespec* start, const size_t transferred, const size_t max_rate) {
+    if (max_rate == 0) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double elapsed = (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+    const double expected = (double)transferred / (double)max_rate;
+    if (expected > elapsed) {
+        const double delay = expected - elapsed;
+        const struct timespec ts = {(time_t)delay, (long)((delay - (double)(time_t)delay) * 1e9)};
+        nanosleep(&ts, NULL);
+    }
+}
+
+/**
+ * @brief Connects the blocking socket `sock` to `addr`, giving up after PEER_TIMEOUT_MS.
+ * @return true if connected, `sock` is blocking again then
+ */
+static bool connect_within(const int sock, const struct sockaddr* addr, const socklen_t addrlen) {
+    const int flags = fcntl(sock, F_GETFL);
+    if (flags == -1 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == -1) {
+        perror("fcntl() failed");
+        return false;
+    }
+    if (connect(sock, addr, addrlen) == -1) {
+        if (errno != EINPROGRESS) {
+            perror("connect() failed");
+            return false;
+        }
+        struct pollfd pfd = {.fd = sock, .events = POLLOUT};
+        const int ready = poll(&pfd, 1, PEER_TIMEOUT_MS);
+        if (ready <= 0) {
+            LOG("connect() %s", ready == 0 ? "timed out" : strerror(errno));
+            return false;
+        }
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &len) == -1 || error != 0) {
+            LOG("connect() failed: %s", strerror(error != 0 ? error : errno));
+            return false;
+        }
+    }
+    if (fcntl(sock, F_SETFL, flags) == -1) {
+        perror("fcntl() failed");
+        return false;
+    }
+    return true;
+}
+
+int peer_connect(const server_info* server) {
+    return peer_connect_host(server->ip, server->port);
+}
+
+int peer_connect_host(const char* host, const char* port) {
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    const int status = getaddrinfo(host, port, &hints, &res);
+    if (status != 0) {
+        LOG("getaddrinfo(%s:%s): %s", host, port, gai_strerror(status));
+        return -1;
+    }
+    const int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sock == -1) {
+        perror("socket() failed");
+        freeaddrinfo(res);
+        return -1;
+    }
+    const bool connected = connect_within(sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (!connected) {
+        LOG("connecting to %s:%s failed", host, port);
+        close(sock);
+        return -1;
+    }
+    /* Every later read and write gives up once the peer stops making progress */
+    const struct timeval timeout = {PEER_TIMEOUT_MS / 1000, (PEER_TIMEOUT_MS % 1000) * 1000};
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == -1 ||
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == -1) {
+        perror("setsockopt(SO_RCVTIMEO/SO_SNDTIMEO) failed");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Uploads `size` bytes of `fd` from `offset`, with PUT or, if `compressed`, as the zlib stream of a ZPUT.
+ */
+static bool put_file(const server_info* server, const char* name, const int fd, const off_t offset, const size_t size,
+                     const bool compressed, const size_t raw_size, const size_t max_rate) {
+    const int sock = peer_connect(server);
+    if (sock == -1) {
+        return false;
+    }
+    char* header_msg;
+    asprintf(&header_msg, "%s %s\n", compressed ? "ZPUT" : "PUT", name);
+    const char encoding = COMPRESS_ZLIB;
+    bool ok = peer_write_all(sock, header_msg, strlen(header_msg)) && read_no_redirect(sock) &&
+              (!compressed || peer_write_all(sock, &encoding, sizeof(encoding))) &&
+              peer_write_all(sock, &raw_size, sizeof(raw_size));
+    free(header_msg);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char buffer[4096];
+    size_t sent = 0;
+    while (ok && sent < size) {
+        const size_t want = size - sent < sizeof(buffer) ? size - sent : sizeof(buffer);
+        const ssize_t read_result = pread(fd, buffer, want, offset + (off_t)sent);
+        if (read_result <= 0) {
+            ok = false;
+            break;
+        }
+        ok = peer_write_all(sock, buffer, read_result);
+        sent += read_result;
+        throttle(&start, sent, max_rate);
+    }
+    if (ok) {
+        shutdown(sock, SHUT_WR);
+        ok = read_ok(sock);
+    }
+    close(sock);
+    return ok;
+}
+
+bool peer_put_file(const server_info* server, const char* name, const int fd, const off_t offset, const size_t size,
+                   const size_t max_rate) {
+    return put_file(server, name, fd, offset, size, false, size, max_rate);
+}
+
+bool peer_put_compressed(const server_info* server, const char* name, const int fd, const size_t size,
+                         const size_t raw_size, const size_t max_rate) {
+    return put_file(server, name, fd, 0, size, true, raw_size, max_rate);
+}
+
+bool peer_get_file(const server_info* server, const char* name, const int fd, const size_t max_rate) {
+    const int sock = peer_connect(server);
+    if (sock == -1) {
+        return false;
+    }
+    char* header_msg;
+    asprintf(&header_msg, "GET %s\n", name);
+    size_t size = 0;
+    bool ok = peer_write_all(sock, header_msg, strlen(header_msg));
+    free(header_msg);
+    shutdown(sock, SHUT_WR);
+    ok = ok && read_ok(sock) && read_no_redirect(sock) && peer_read_all(sock, &size, sizeof(size));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char buffer[4096];
+    size_t received = 0;
+    while (ok && received < size) {
+        const size_t want = size - received < sizeof(buffer) ? size - received : sizeof(buffer);
+        const ssize_t read_result = read(sock, buffer, want);
+        if (read_result <= 0 || !peer_write_all(fd, buffer, read_result)) {
+            ok = false;
+            break;
+        }
+        received += read_result;
+        throttle(&start, received, max_rate);
+    }
+    close(sock);
+    return ok;
+}
+
+bool peer_delete_file(const server_info* server, const char* name) {
+    const int sock = peer_connect(server);
+    if (sock == -1) {
+        return false;
+    }
+    char* header_msg;
+    asprintf(&header_msg, "DELETE %s\n", name);
+    bool ok = peer_write_all(sock, header_msg, strlen(header_msg));
+    free(header_msg);
+    shutdown(sock, SHUT_WR);
+    ok = ok && read_ok(sock);
+    close(sock);
+    return ok;
+}
+
+bool peer_link_file(const server_info* server, const char* name, const char* hex) {
+    const int sock = peer_connect(server);
+    if (sock == -1) {
+        return false;
+    }
+    char* header_msg;
+    asprintf(&header_msg, "LINK %s %s\n", name, hex);
+    bool ok = peer_write_all(sock, header_msg, strlen(header_msg));
+    free(header_msg);
+    shutdown(sock, SHUT_WR);
+    ok = ok && read_ok(sock);
+    close(sock);
+    return ok;
+}
@@ -0,0 +1,76 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "catalog.h"
+
+/**
+ * Blocking requests from this server to another Pi-Share server, speaking the same protocol as client.c.
+ * These are meant for background threads (rebalancing, caching); never call them from the epoll loop.
+ * A peer that does not answer for PEER_TIMEOUT_MS makes the request fail instead of stalling the thread.
+ */
+#define PEER_TIMEOUT_MS 10000
+
+/**
+ * @brief Opens a TCP connection to `server`, with PEER_TIMEOUT_MS applied to connecting, reading and writing.
+ * @return the connected socket, or -1 on failure
+ */
+int peer_connect(const server_info* server);
+
+/**
+ * @brief Same as peer_connect, for a server given by host name or address.
+ */
+int peer_connect_host(const char* host, const char* port);
+
+/**
+ * @brief Writes all `size` bytes of `data` to the blocking socket `sock`.
+ * @return false if the connection failed first
+ */
+bool peer_write_all(int sock, const void* data, size_t size);
+
+/**
+ * @brief Reads exactly `size` bytes from the blocking socket `sock`.
+ * @return false if the connection was closed or failed first
+ */
+bool peer_read_all(int sock, void* buffer, size_t size);
+
+/**
+ * @brief Uploads `size` bytes from `fd`, starting at `offset`, to `server` as `name`.
+ * @param max_rate upper bound on the transfer rate in bytes per second, 0 for unlimited
+ * @return true if `server` stored the file itself and acknowledged it
+ */
+bool peer_put_file(const server_info* server, const char* name, int fd, off_t offset, size_t size, size_t max_rate);
+
+/**
+ * @brief Uploads the stored compressed file `fd` of `size` bytes to `server` as `name` with ZPUT, without
+ * decompressing it first.
+ * @param raw_size the uncompressed size (see compress_is_stored)
+ * @param max_rate see peer_put_file
+ * @return see peer_put_file
+ */
+bool peer_put_compressed(const server_info* server, const char* name, int fd, size_t size, size_t raw_size,
+                         size_t max_rate);
+
+/**
+ * @brief Downloads `name` from `server` into `fd`.
+ * @param max_rate upper bound on the transfer rate in bytes per second, 0 for unlimited
+ * @return true if `server` served the file itself and all of it was received
+ */
+bool peer_get_file(const server_info* server, const char* name, int fd, size_t max_rate);
+
+/**
+ * @brief Deletes `name` from `server`.
+ * @return true if `server` acknowledged the deletion
+ */
+bool peer_delete_file(const server_info* server, const char* name);
+
+/**
+ * @brief Asks `server` to store `name` with the contents of the SHA-256 `hex`, if it already has them.
+ * @return true if it did, otherwise the file has to be uploaded
+ */
+bool peer_link_file(const server_info* server, const char* name, const char* hex);
@@ -0,0 +1,297 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "hotcache.h"
+#include "peer.h"
+#include "pullcache.h"
+#include "includes/dictionary.h"
+#include "includes/queue.h"
+
+#define PULLCACHE_MAX_COUNTED 4096 // Names redirects are counted for before expired counts are dropped
+
+typedef struct copy {
+    char* name;
+    server_info server; // Where it was fetched from
+    unsigned long id; // The copy is PULLCACHE_DIR/<id>
+    size_t size;
+    struct copy* prev; // Towards the most recently served
+    struct copy* next;
+} copy;
+
+typedef struct {
+    unsigned redirects;
+    time_t window_start;
+    bool fetching;
+    bool stale; // Changed while it was being fetched, so the copy must not be kept
+} redirect_count;
+
+typedef struct {
+    char* name;
+    server_info server;
+    unsigned long resyncs; // Value of `resyncs` when the job was queued
+} fetch_job;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned threshold;
+static size_t capacity;
+static size_t used;
+static unsigned long next_id;
+static unsigned long resyncs; // Counts pullcache_forget_server calls, which make every running fetch stale
+static dictionary* copies; // name -> copy*
+static dictionary* counts; // name -> redirect_count*, owned
+static copy* newest;
+static copy* oldest;
+static queue* jobs; // fetch_job*
+
+static void copy_path(const unsigned long id, char path[64]) {
+    snprintf(path, 64, PULLCACHE_DIR "/%08lu", id);
+}
+
+static void unlink_copy(copy* c) {
+    if (c->prev != NULL) {
+        c->prev->next = c->next;
+    } else {
+        newest = c->next;
+    }
+    if (c->next != NULL) {
+        c->next->prev = c->prev;
+    } else {
+        oldest = c->prev;
+    }
+}
+
+static void push_newest(copy* c) {
+    c->prev = NULL;
+    c->next = newest;
+    if (newest != NULL) {
+        newest->prev = c;
+    } else {
+        oldest = c;
+    }
+    newest = c;
+}
+
+/**
+ * @brief Removes `c` and its file. Descriptors handed out by pullcache_open keep working.
+ */
+static void drop_copy(copy* c) {
+    char path[64];
+    copy_path(c->id, path);
+    unlink(path);
+    unlink_copy(c);
+    dictionary_remove(copies, c->name);
+    used -= c->size;
+    hotcache_invalidate(c->name);
+    free(c->name);
+    free(c);
+}
+
+/**
+ * @brief Forgets the redirects of names that were not redirected within the window.
+ */
+static void prune_counts(const time_t now) {
+    vector* names = dictionary_keys(counts);
+    VECTOR_FOR_EACH(
+        names, name,
+        redirect_count* count = dictionary_get(counts, name);
+        if (!count->fetching && now - count->window_start >= PULLCACHE_WINDOW) {
+            dictionary_remove(counts, name);
+        }
+    );
+    vector_destroy(names);
+}
+
+/**
+ * @brief Downloads `job->name` into a new copy and adds it, unless it changed in the meantime.
+ */
+static void fetch(const fetch_job* job) {
+    pthread_mutex_lock(&lock);
+    const unsigned long id = next_id++;
+    pthread_mutex_unlock(&lock);
+    char path[64];
+    copy_path(id, path);
+    const int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    struct stat s;
+    bool ok = fd != -1 && peer_get_file(&job->server, job->name, fd, 0) && fstat(fd, &s) == 0 &&
+              (size_t)s.st_size <= capacity;
+    if (fd != -1) {
+        close(fd);
+    }
+    server_info current;
+    ok = ok && catalog_lookup_remote(job->name, &current) && server_info_equals(&current, &job->server);
+
+    pthread_mutex_lock(&lock);
+    redirect_count* count = dictionary_contains(counts, job->name) ? dictionary_get(counts, job->name) : NULL;
+    ok = ok && job->resyncs == resyncs && count != NULL && !count->stale;
+    if (count != NULL) {
+        count->fetching = false;
+        count->stale = false;
+        count->redirects = 0;
+    }
+    if (ok) {
+        if (dictionary_contains(copies, job->name)) {
+            drop_copy(dictionary_get(copies, job->name));
+        }
+        while (used + s.st_size > capacity && oldest != NULL) {
+            drop_copy(oldest);
+        }
+        copy* c = calloc(1, sizeof(copy));
+        c->name = strdup(job->name);
+        c->server = job->server;
+        c->id = id;
+        c->size = s.st_size;
+        used += c->size;
+        push_newest(c);
+        dictionary_set(copies, c->name, c);
+        LOG("pullcache: keeping a copy of %s from %s:%s", c->name, c->server.ip, c->server.port);
+    } else {
+        unlink(path);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void* fetch_worker(void* arg) {
+    (void)arg;
+    while (true) {
+        fetch_job* job = queue_pull(jobs);
+        fetch(job);
+        free(job->name);
+        free(job);
+    }
+    return NULL;
+}
+
+void pullcache_init(const char* dir, const unsigned redirects, const size_t bytes) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, PULLCACHE_DIR);
+    /* Copies from an earlier run may be out of date */
+    DIR* d = opendir(path);
+    if (d != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(d)) != NULL) {
+            if (entry->d_name[0] != '.') {
+                unlinkat(dirfd(d), entry->d_name, 0);
+            }
+        }
+        closedir(d);
+    }
+    threshold = redirects;
+    capacity = bytes;
+    if (threshold == 0) {
+        rmdir(path);
+        return;
+    }
+    if (mkdir(path, 0777) == -1 && errno != EEXIST) {
+        perror("creating the pull cache directory failed");
+        threshold = 0;
+        return;
+    }
+    copies = dictionary_create(string_hash_function, string_compare, NULL, NULL, NULL, NULL);
+    counts = dictionary_create(string_hash_function, string_compare, string_copy_constructor, free, NULL, free);
+    jobs = queue_create(-1);
+
+    if (!spawn_detached(fetch_worker, NULL)) {
+        exit(1);
+    }
+}
+
+void pullcache_redirected(const char* name, const server_info* server) {
+    if (threshold == 0) {
+        return;
+    }
+    const time_t now = time(NULL);
+    pthread_mutex_lock(&lock);
+    if (dictionary_contains(copies, (void*)name)) {
+        pthread_mutex_unlock(&lock); /* Fetched while this GET was being answered */
+        return;
+    }
+    redirect_count* count = NULL;
+    if (dictionary_contains(counts, (void*)name)) {
+        count = dictionary_get(counts, (void*)name);
+    } else {
+        if (dictionary_size(counts) >= PULLCACHE_MAX_COUNTED) {
+            prune_counts(now);
+        }
+        count = calloc(1, sizeof(redirect_count));
+        count->window_start = now;
+        dictionary_set(counts, (void*)name, count);
+    }
+    if (now - count->window_start >= PULLCACHE_WINDOW) {
+        count->window_start = now;
+        count->redirects = 0;
+    }
+    if (++count->redirects >= threshold && !count->fetching) {
+        count->fetching = true;
+        fetch_job* job = malloc(sizeof(fetch_job));
+        job->name = strdup(name);
+        job->server = *server;
+        job->resyncs = resyncs;
+        queue_push(jobs, job);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int pullcache_open(const char* name, size_t* size) {
+    if (threshold == 0) {
+        return -1;
+    }
+    int fd = -1;
+    pthread_mutex_lock(&lock);
+    if (dictionary_contains(copies, (void*)name)) {
+        copy* c = dictionary_get(copies, (void*)name);
+        char path[64];
+        copy_path(c->id, path);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd != -1) {
+            *size = c->size;
+            unlink_copy(c);
+            push_newest(c);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return fd;
+}
+
+void pullcache_invalidate(const char* name) {
+    if (threshold == 0) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    if (dictionary_contains(copies, (void*)name)) {
+        drop_copy(dictionary_get(copies, (void*)name));
+    }
+    if (dictionary_contains(counts, (void*)name)) {
+        redirect_count* count = dictionary_get(counts, (void*)name);
+        count->stale = count->fetching;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void pullcache_forget_server(const server_info* server) {
+    if (threshold == 0) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    ++resyncs;
+    for (copy* c = newest; c != NULL;) {
+        copy* next = c->next;
+        if (server_info_equals(&c->server, server)) {
+            drop_copy(c);
+        }
+        c = next;
+    }
+    pthread_mutex_unlock(&lock);
+}
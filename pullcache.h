@@ -0,0 +1,54 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stddef.h>
+
+#include "catalog.h"
+
+/**
+ * Pull-through caching of files stored on sub-servers: once GETs of a file were redirected to its sub-server
+ * often enough within PULLCACHE_WINDOW seconds, a background thread downloads a copy into Pi-Share/PULLCACHE_DIR
+ * and later GETs are served from that copy instead of sending clients to the sub-server.
+ *
+ * Copies are kept until the cache is full, then the least recently served one is removed. A copy is dropped as soon
+ * as we learn that the file changed (pullcache_invalidate), and all copies from a sub-server are dropped when it
+ * resends its whole catalog (pullcache_forget_server). The cache only lives as long as the process; whatever is left
+ * in PULLCACHE_DIR is removed on startup.
+ *
+ * Paths are relative to the share directory, which has to be the working directory once pullcache_init returned.
+ */
+#define PULLCACHE_DIR ".pi-share-pulled"
+#define PULLCACHE_WINDOW 60 // Seconds redirects of a file are counted over
+#define PULLCACHE_DEFAULT_SIZE (256 * 1024 * 1024)
+
+/**
+ * @brief Prepares the cache directory of the share directory `dir` and starts the thread that fetches copies.
+ * @param threshold redirects within PULLCACHE_WINDOW after which a file is copied, 0 disables the cache
+ * @param capacity bytes the copies may take up at most
+ */
+void pullcache_init(const char* dir, unsigned threshold, size_t capacity);
+
+/**
+ * @brief Counts a GET of `name` that was redirected to `server`, and fetches a copy once that happens often.
+ */
+void pullcache_redirected(const char* name, const server_info* server);
+
+/**
+ * @brief Opens our copy of `name`, if we have one.
+ * @param size receives its size
+ * @return a descriptor the caller has to close, or -1
+ */
+int pullcache_open(const char* name, size_t* size);
+
+/**
+ * @brief Drops our copy of `name`, and the contents of `name` in the hot file cache.
+ * Call whenever the file changes or is removed on its sub-server.
+ */
+void pullcache_invalidate(const char* name);
+
+/**
+ * @brief Drops every copy fetched from `server`.
+ */
+void pullcache_forget_server(const server_info* server);
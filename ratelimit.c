@@ -0,0 +1,180 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ratelimit.h"
+#include "includes/dictionary.h"
+#include "includes/vector.h"
+
+#define RATELIMIT_SWEEP_INTERVAL 1.0 // Seconds between looks for addresses whose buckets can be forgotten
+
+typedef struct {
+    double rate; // Bytes per second, 0 for no limit
+    double tokens;
+    double refilled; // Seconds (monotonic) `tokens` was last brought up to date at
+} token_bucket;
+
+struct ratelimit_client {
+    char* ip;
+    size_t connections; // 0 while the bucket is kept only until it refilled
+    token_bucket bucket;
+};
+
+static token_bucket global;
+static token_bucket get_bucket;
+static token_bucket put_bucket;
+static size_t client_rate;
+static dictionary* clients; // ip -> ratelimit_client*, including addresses with no connection left
+static double last_sweep;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bucket_init(token_bucket* bucket, const size_t rate) {
+    bucket->rate = rate;
+    bucket->tokens = rate; /* Starts full */
+    bucket->refilled = now();
+}
+
+static void refill(token_bucket* bucket, const double t) {
+    bucket->tokens += (t - bucket->refilled) * bucket->rate;
+    if (bucket->tokens > bucket->rate) {
+        bucket->tokens = bucket->rate;
+    }
+    bucket->refilled = t;
+}
+
+/**
+ * @brief Fills `buckets` with the buckets that limit a transfer of `action` by `client`.
+ * @return how many there are
+ */
+static int buckets_of(ratelimit_client* client, const verb action, token_bucket* buckets[3]) {
+    int count = 0;
+    if (global.rate > 0) {
+        buckets[count++] = &global;
+    }
+    if (action == GET && get_bucket.rate > 0) {
+        buckets[count++] = &get_bucket;
+    } else if (action == PUT && put_bucket.rate > 0) {
+        buckets[count++] = &put_bucket;
+    }
+    if (client != NULL) {
+        buckets[count++] = &client->bucket;
+    }
+    return count;
+}
+
+void ratelimit_init(const size_t global_rate, const size_t get_rate, const size_t put_rate, const size_t per_client) {
+    bucket_init(&global, global_rate);
+    bucket_init(&get_bucket, get_rate);
+    bucket_init(&put_bucket, put_rate);
+    client_rate = per_client;
+    if (client_rate > 0) {
+        clients = dictionary_create(string_hash_function, string_compare, NULL, NULL, NULL, NULL);
+    }
+}
+
+bool ratelimit_enabled(void) {
+    return global.rate > 0 || get_bucket.rate > 0 || put_bucket.rate > 0 || client_rate > 0;
+}
+
+static void forget(ratelimit_client* client) {
+    dictionary_remove(clients, client->ip);
+    free(client->ip);
+    free(client);
+}
+
+/**
+ * @brief Forgets the addresses without connections whose buckets are full again, as a new bucket would be the same.
+ */
+static void sweep_idle(const double t) {
+    if (t - last_sweep < RATELIMIT_SWEEP_INTERVAL) {
+        return;
+    }
+    last_sweep = t;
+    vector* idle = dictionary_values(clients);
+    for (size_t i = 0; i < vector_size(idle); ++i) {
+        ratelimit_client* client = vector_get(idle, i);
+        if (client->connections == 0) {
+            refill(&client->bucket, t);
+            if (client->bucket.tokens >= client->bucket.rate) {
+                forget(client);
+            }
+        }
+    }
+    vector_destroy(idle);
+}
+
+ratelimit_client* ratelimit_connect(const char* ip) {
+    if (client_rate == 0) {
+        return NULL;
+    }
+    sweep_idle(now());
+    ratelimit_client* client = NULL;
+    if (dictionary_contains(clients, (void*)ip)) {
+        client = dictionary_get(clients, (void*)ip);
+    } else {
+        client = calloc(1, sizeof(ratelimit_client));
+        client->ip = strdup(ip);
+        bucket_init(&client->bucket, client_rate);
+        dictionary_set(clients, client->ip, client);
+    }
+    ++client->connections;
+    return client;
+}
+
+void ratelimit_disconnect(ratelimit_client* client) {
+    if (client == NULL || --client->connections > 0) {
+        return;
+    }
+    /* One request per connection: the next one from this address must not start with a fresh bucket */
+    refill(&client->bucket, now());
+    if (client->bucket.tokens >= client->bucket.rate) {
+        forget(client);
+    }
+}
+
+size_t ratelimit_allowance(ratelimit_client* client, const verb action, const size_t want) {
+    token_bucket* buckets[3];
+    const int count = buckets_of(client, action, buckets);
+    const double t = now();
+    size_t allowed = want;
+    for (int i = 0; i < count; ++i) {
+        refill(buckets[i], t);
+        if (buckets[i]->tokens < allowed) {
+            allowed = buckets[i]->tokens > 0 ? (size_t)buckets[i]->tokens : 0;
+        }
+    }
+    return allowed;
+}
+
+void ratelimit_spend(ratelimit_client* client, const verb action, const size_t bytes) {
+    token_bucket* buckets[3];
+    const int count = buckets_of(client, action, buckets);
+    for (int i = 0; i < count; ++i) {
+        /* May go below zero when bytes moved that were not asked for, like a response header */
+        buckets[i]->tokens -= bytes;
+    }
+}
+
+unsigned ratelimit_wait(ratelimit_client* client, const verb action) {
+    token_bucket* buckets[3];
+    const int count = buckets_of(client, action, buckets);
+    const double t = now();
+    double wait = 0;
+    for (int i = 0; i < count; ++i) {
+        refill(buckets[i], t);
+        const double need = buckets[i]->rate < RATELIMIT_MIN_SEND ? buckets[i]->rate : RATELIMIT_MIN_SEND;
+        if (buckets[i]->tokens < need && (need - buckets[i]->tokens) / buckets[i]->rate > wait) {
+            wait = (need - buckets[i]->tokens) / buckets[i]->rate;
+        }
+    }
+    return (unsigned)(wait * 1000) + 1;
+}
@@ -0,0 +1,55 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "common.h"
+
+/**
+ * Token buckets that cap the bandwidth of transfers: one for the whole server, one per verb (GET and PUT) and one
+ * per client IP address, shared by all connections from that address. A transfer may only move as many bytes as
+ * every bucket that applies to it holds; when one of them is empty, the connection is paused until it refilled.
+ *
+ * Each bucket refills at its rate and holds at most one second of it. Rates are in bytes per second, 0 means no
+ * limit. Only to be used from the epoll thread.
+ */
+#define RATELIMIT_MIN_SEND 4096 // A paused connection waits until it can move at least this much
+
+typedef struct ratelimit_client ratelimit_client;
+
+void ratelimit_init(size_t global_rate, size_t get_rate, size_t put_rate, size_t client_rate);
+
+/**
+ * @return whether any limit is set
+ */
+bool ratelimit_enabled(void);
+
+/**
+ * @brief Starts counting the transfers of a connection from `ip` against that address.
+ * @return the per-address state to pass to the other functions, NULL without a per-client limit
+ */
+ratelimit_client* ratelimit_connect(const char* ip);
+
+/**
+ * @brief Ends a connection. The state of its address is dropped once no connection from there is left and its
+ * bucket refilled, so the limit applies across the connections an address opens one after another.
+ */
+void ratelimit_disconnect(ratelimit_client* client);
+
+/**
+ * @return how many of `want` bytes a transfer of `action` by `client` may move right now
+ */
+size_t ratelimit_allowance(ratelimit_client* client, verb action, size_t want);
+
+/**
+ * @brief Takes `bytes` that a transfer of `action` by `client` moved out of its buckets.
+ */
+void ratelimit_spend(ratelimit_client* client, verb action, size_t bytes);
+
+/**
+ * @return milliseconds until the buckets of a transfer of `action` by `client` allow RATELIMIT_MIN_SEND bytes again
+ */
+unsigned ratelimit_wait(ratelimit_client* client, verb action);
@@ -0,0 +1,193 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "compress.h"
+#include "fdcache.h"
+#include "hotcache.h"
+#include "layout.h"
+#include "pack.h"
+#include "peer.h"
+#include "rebalance.h"
+#include "sha256.h"
+#include "includes/queue.h"
+
+static queue* jobs; // server_info* of newly added sub-servers
+static size_t rate;
+
+/**
+ * @brief Stores `size` bytes of `fd` from `offset` on `target` as `name`. Contents `target` already has are linked
+ * there by their hash instead of being sent again, and stored compressed files are sent as they are.
+ */
+static bool send_file(const server_info* target, const char* name, const int fd, const off_t offset,
+                      const size_t size) {
+    size_t raw_size;
+    if (compress_is_stored(fd, &raw_size)) {
+        return peer_put_compressed(target, name, fd, size, raw_size, rate);
+    }
+    unsigned char digest[SHA256_SIZE];
+    char hex[SHA256_HEX_SIZE];
+    if (size >= LINK_MIN_SIZE && sha256_fd(fd, offset, size, digest)) {
+        sha256_to_hex(digest, hex);
+        if (peer_link_file(target, name, hex)) {
+            return true;
+        }
+    }
+    return peer_put_file(target, name, fd, offset, size, rate);
+}
+
+/**
+ * @brief Copies the local file `name` to `target` and, if it didn't change in the meantime, hands it over.
+ * The catalog switches to `target` and the local copy is removed in one step under the catalog lock.
+ * @return true if the file now lives on `target`
+ */
+static bool move_local_file(const char* name, const server_info* target) {
+    char path_buffer[LAYOUT_PATH_MAX];
+    const char* path = layout_path(name, path_buffer);
+    /* A packed file is identified by its pack version, a loose one by its inode, size and mtime */
+    const uint64_t packed = pack_version(name);
+    off_t offset = 0;
+    size_t size = 0;
+    const int fd = packed != 0 ? pack_open(name, &offset, &size) : open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat before;
+    if (fstat(fd, &before) == -1 || catalog_is_being_written(name) ||
+        !send_file(target, name, fd, offset, packed != 0 ? size : (size_t)before.st_size)) {
+        close(fd);
+        return false;
+    }
+    close(fd);
+
+    catalog_lock();
+    struct stat after;
+    bool unchanged = catalog_has_local(name) && !catalog_is_being_written(name);
+    if (packed != 0) {
+        unchanged = unchanged && pack_version(name) == packed;
+    } else {
+        unchanged = unchanged && stat(path, &after) == 0 && after.st_ino == before.st_ino &&
+                    after.st_size == before.st_size && after.st_mtim.tv_sec == before.st_mtim.tv_sec &&
+                    after.st_mtim.tv_nsec == before.st_mtim.tv_nsec;
+    }
+    if (unchanged) {
+        catalog_remove_local(name);
+        catalog_set_remote(name, target);
+        hotcache_invalidate(name);
+        fdcache_invalidate(name);
+        if (packed != 0) {
+            pack_remove(name);
+        } else {
+            unlink(path);
+        }
+    }
+    catalog_unlock();
+    if (!unchanged) {
+        /* Someone wrote or deleted the file while we were copying, our copy is stale */
+        peer_delete_file(target, name);
+    }
+    return unchanged;
+}
+
+/**
+ * @brief Copies `name` from the sub-server `source` to `target` through a temporary file and then repoints the catalog.
+ * @return true if the file now lives on `target`
+ */
+static bool move_remote_file(const char* name, const server_info* source, const server_info* target) {
+    FILE* tmp = tmpfile();
+    if (tmp == NULL) {
+        return false;
+    }
+    const int fd = fileno(tmp);
+    struct stat s;
+    bool ok = peer_get_file(source, name, fd, rate) && fstat(fd, &s) == 0 &&
+              send_file(target, name, fd, 0, s.st_size);
+    fclose(tmp);
+    if (!ok) {
+        return false;
+    }
+
+    catalog_lock();
+    server_info current;
+    ok = catalog_lookup_remote(name, &current) && server_info_equals(&current, source);
+    if (ok) {
+        catalog_set_remote(name, target);
+    }
+    catalog_unlock();
+    peer_delete_file(ok ? source : target, name);
+    return ok;
+}
+
+/**
+ * @brief Moves files from the main server and the fullest sub-servers onto `target`
+ * until every node holds roughly the same number of files.
+ */
+static void rebalance_onto(const server_info* target) {
+    const size_t nodes = catalog_server_count() + 1;
+    const size_t share = (catalog_local_count() + catalog_remote_count()) / nodes;
+    vector* on_target = catalog_files_on(target);
+    size_t moved = vector_size(on_target);
+    vector_destroy(on_target);
+    LOG("rebalance: moving up to %zu files onto %s:%s", share > moved ? share - moved : 0, target->ip,
+        target->port);
+
+    vector* local = catalog_local_files();
+    for (size_t i = 0; i < vector_size(local) && moved < share && catalog_local_count() > share; ++i) {
+        if (move_local_file(vector_get(local, i), target)) {
+            ++moved;
+        }
+    }
+    vector_destroy(local);
+
+    server_info source;
+    for (size_t i = 0; moved < share && catalog_get_server(i, &source); ++i) {
+        if (server_info_equals(&source, target)) {
+            continue;
+        }
+        vector* remote = catalog_files_on(&source);
+        size_t remaining = vector_size(remote);
+        for (size_t j = 0; j < vector_size(remote) && moved < share && remaining > share; ++j) {
+            if (move_remote_file(vector_get(remote, j), &source, target)) {
+                ++moved;
+                --remaining;
+            }
+        }
+        vector_destroy(remote);
+    }
+    LOG("rebalance: %s:%s now holds %zu files", target->ip, target->port, moved);
+}
+
+static void* rebalance_worker(void* arg) {
+    (void)arg;
+    while (true) {
+        server_info* target = queue_pull(jobs);
+        rebalance_onto(target);
+        free(target);
+    }
+    return NULL;
+}
+
+void rebalance_init(const size_t max_rate) {
+    rate = max_rate;
+    if (rate == 0) {
+        return;
+    }
+    jobs = queue_create(-1);
+
+    if (!spawn_detached(rebalance_worker, NULL)) {
+        exit(1);
+    }
+}
+
+void rebalance_server_added(const server_info* server) {
+    if (jobs == NULL) {
+        return;
+    }
+    queue_push(jobs, server_info_copy_constructor((void*)server));
+}
@@ -0,0 +1,24 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stddef.h>
+
+#include "catalog.h"
+
+// Default upper bound on the bandwidth used to move files onto a new sub-server, in bytes per second
+#define REBALANCE_DEFAULT_RATE (1024 * 1024)
+
+/**
+ * @brief Starts the background rebalancer thread.
+ * @param max_rate upper bound on the bandwidth used while moving files, in bytes per second.
+ * 0 disables rebalancing.
+ */
+void rebalance_init(size_t max_rate);
+
+/**
+ * @brief Schedules moving files onto the newly registered `server` until it holds its share of the catalog.
+ * Returns immediately; files keep being served from their old location until their copy is complete.
+ */
+void rebalance_server_added(const server_info* server);
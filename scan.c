@@ -0,0 +1,231 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "catalog.h"
+#include "catalog_sync.h"
+#include "common.h"
+#include "layout.h"
+#include "pack.h"
+#include "scan.h"
+#include "includes/set.h"
+
+#define SCAN_BUFFER_SIZE (1024 * 1024) // Bytes of directory entries read per getdents64 call
+#define SCAN_MIN_PARALLEL 256 // Fewer entries to stat than this are not worth starting threads for
+
+/* Layout of the records returned by getdents64, declared here since not every libc exposes it */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    int dir_fd;
+    char** names;
+    bool* regular;
+    size_t begin;
+    size_t end;
+} stat_job;
+
+static void* stat_worker(void* arg) {
+    stat_job* job = arg;
+    for (size_t i = job->begin; i < job->end; ++i) {
+        struct stat s;
+        /* Follow symbolic links, like the stat() this replaces did */
+        job->regular[i] = fstatat(job->dir_fd, job->names[i], &s, 0) == 0 && S_ISREG(s.st_mode);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Stats the `count` entries in `names`, setting `regular[i]` for the regular files.
+ */
+static void stat_entries(const int dir_fd, char** names, bool* regular, const size_t count, size_t threads) {
+    if (threads < 2 || count < SCAN_MIN_PARALLEL) {
+        stat_job job = {dir_fd, names, regular, 0, count};
+        stat_worker(&job);
+        return;
+    }
+    pthread_t* tids = malloc(threads * sizeof(pthread_t));
+    stat_job* jobs = malloc(threads * sizeof(stat_job));
+    const size_t per_thread = (count + threads - 1) / threads;
+    size_t started = 0;
+    for (size_t t = 0; t < threads && t * per_thread < count; ++t) {
+        const size_t end = (t + 1) * per_thread < count ? (t + 1) * per_thread : count;
+        jobs[t] = (stat_job){dir_fd, names, regular, t * per_thread, end};
+        if (pthread_create(&tids[t], NULL, stat_worker, &jobs[t]) != 0) {
+            stat_worker(&jobs[t]);
+            continue;
+        }
+        started = t + 1;
+    }
+    for (size_t t = 0; t < started; ++t) {
+        pthread_join(tids[t], NULL);
+    }
+    free(tids);
+    free(jobs);
+}
+
+/**
+ * @brief Reads the names of the regular files directly inside `path`, handing them to `found` one batch at a time.
+ * The names in a batch are only valid until `found` returns.
+ * @return the number of files found, or -1 if `path` could not be read
+ */
+static long scan(const char* path, const size_t threads, void (*found)(vector* names, void* ctx), void* ctx) {
+    const int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        return -1;
+    }
+    char* buffer = malloc(SCAN_BUFFER_SIZE);
+    vector* files = shallow_vector_create(); // Points into buffer, `found` copies the names it keeps
+    vector* unknown = shallow_vector_create(); // Entries whose type we have to stat for
+    bool* regular = NULL;
+    size_t regular_cap = 0;
+    long total = 0;
+    long read_result;
+    while ((read_result = syscall(SYS_getdents64, dir_fd, buffer, SCAN_BUFFER_SIZE)) > 0) {
+        for (long pos = 0; pos < read_result;) {
+            struct linux_dirent64* entry = (struct linux_dirent64*)(buffer + pos);
+            pos += entry->d_reclen;
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            if (entry->d_type == DT_REG) {
+                vector_push_back(files, entry->d_name);
+            } else if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                vector_push_back(unknown, entry->d_name);
+            }
+        }
+        const size_t n_unknown = vector_size(unknown);
+        if (n_unknown > 0) {
+            if (n_unknown > regular_cap) {
+                regular_cap = n_unknown;
+                regular = realloc(regular, regular_cap * sizeof(bool));
+            }
+            stat_entries(dir_fd, (char**)vector_begin(unknown), regular, n_unknown, threads);
+            for (size_t i = 0; i < n_unknown; ++i) {
+                if (regular[i]) {
+                    vector_push_back(files, vector_get(unknown, i));
+                }
+            }
+        }
+        found(files, ctx);
+        total += (long)vector_size(files);
+        vector_clear(files);
+        vector_clear(unknown);
+    }
+    if (read_result == -1) {
+        perror("getdents64() failed");
+    }
+    vector_destroy(files);
+    vector_destroy(unknown);
+    free(regular);
+    free(buffer);
+    close(dir_fd);
+    return total;
+}
+
+/**
+ * @brief Same as scan, for a share directory in either layout, including the files stored in packs.
+ */
+static long scan_share(const char* path, const size_t threads, void (*found)(vector* names, void* ctx), void* ctx) {
+    vector* packed = pack_names();
+    const long total_packed = (long)vector_size(packed);
+    found(packed, ctx);
+    vector_destroy(packed);
+    if (!layout_hashed()) {
+        const long total = scan(path, threads, found, ctx);
+        return total == -1 ? -1 : total + total_packed;
+    }
+    char sub[1024];
+    long total = total_packed;
+    for (int i = 0; i < LAYOUT_FANOUT * LAYOUT_FANOUT; ++i) {
+        snprintf(sub, sizeof(sub), "%s/" LAYOUT_DIR "/%02x/%02x", path, i / LAYOUT_FANOUT, i % LAYOUT_FANOUT);
+        const long found_here = scan(sub, threads, found, ctx);
+        if (found_here > 0) {
+            total += found_here;
+        }
+    }
+    return total;
+}
+
+static void add_to_catalog(vector* names, void* ctx) {
+    (void)ctx;
+    catalog_add_local_many(names);
+}
+
+long scan_local_files(const char* path, const size_t threads) {
+    return scan_share(path, threads, add_to_catalog, NULL);
+}
+
+static void add_to_set(vector* names, void* ctx) {
+    VECTOR_FOR_EACH(names, name, set_add(ctx, name););
+}
+
+set* scan_file_names(const char* path, const size_t threads) {
+    set* names = string_set_create();
+    if (scan_share(path, threads, add_to_set, names) == -1) {
+        set_destroy(names);
+        return NULL;
+    }
+    return names;
+}
+
+long scan_reconcile(const char* dir, const size_t threads) {
+    set* on_disk = scan_file_names(dir, threads);
+    if (on_disk == NULL) {
+        perror("scanning Pi-Share failed");
+        return -1;
+    }
+    const int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    size_t added = 0, removed = 0;
+    vector* known = catalog_local_files();
+    VECTOR_FOR_EACH(known, name, {
+        if (set_contains(on_disk, name)) {
+            set_remove(on_disk, name);
+            continue;
+        }
+        struct stat s;
+        char path[LAYOUT_PATH_MAX];
+        catalog_lock();
+        if (!pack_contains(name) && fstatat(dir_fd, layout_path(name, path), &s, 0) == -1 &&
+            !catalog_is_being_written(name) && catalog_remove_local(name)) {
+            catalog_sync_record(SYNC_REMOVE, name);
+            ++removed;
+        }
+        catalog_unlock();
+    });
+    vector_destroy(known);
+    /* What is left on disk is missing from the catalog */
+    SET_FOR_EACH(on_disk, name, {
+        struct stat s;
+        char path[LAYOUT_PATH_MAX];
+        catalog_lock();
+        if (!catalog_has_local(name) && fstatat(dir_fd, layout_path(name, path), &s, 0) == 0 && S_ISREG(s.st_mode)) {
+            catalog_add_local(name);
+            catalog_sync_record(SYNC_ADD, name);
+            ++added;
+        }
+        catalog_unlock();
+    });
+    close(dir_fd);
+    set_destroy(on_disk);
+    LOG("reconciled the catalog with %s, %zu files added and %zu removed", dir, added, removed);
+    return (long)(added + removed);
+}
@@ -0,0 +1,33 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stddef.h>
+
+#include "includes/set.h"
+
+// Default number of threads that stat entries whose type the file system does not report
+#define SCAN_DEFAULT_THREADS 4
+
+/**
+ * @brief Adds every regular file stored in the share directory `path` to the catalog's local files (see layout.h).
+ * Entries are read in large getdents64 batches and their d_type is trusted; only entries of unknown type and
+ * symbolic links are stat'ed, spread over `threads` threads when there are many of them.
+ * @param threads number of threads used to stat entries, 0 or 1 stats them on the calling thread
+ * @return the number of files added, or -1 if `path` could not be read
+ */
+long scan_local_files(const char* path, size_t threads);
+
+/**
+ * @brief Same scan as scan_local_files, but collects the names instead of touching the catalog.
+ * @return a set of the file names the caller has to set_destroy, or NULL if `path` could not be read
+ */
+set* scan_file_names(const char* path, size_t threads);
+
+/**
+ * @brief Brings the catalog's local files in line with what is actually in `dir`, e.g. after restoring a snapshot.
+ * Every difference is checked again under the catalog lock, since PUTs and DELETEs keep going while we scan.
+ * @return the number of files added or removed, or -1 if `dir` could not be read
+ */
+long scan_reconcile(const char* dir, size_t threads);
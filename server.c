@@ -2,22 +2,48 @@
  * nonstop_networking
  * CS 341 - Spring 2025
  */
-#include <dirent.h>
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <linux/sockios.h>
 #include <netdb.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <bits/socket.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 
+#include "catalog.h"
+#include "catalog_sync.h"
 #include "common.h"
+#include "compress.h"
+#include "dedup.h"
+#include "diskpool.h"
+#include "fanout.h"
+#include "fdcache.h"
 #include "format.h"
+#include "hotcache.h"
+#include "layout.h"
+#include "pack.h"
+#include "pullcache.h"
+#include "ratelimit.h"
+#include "rebalance.h"
+#include "scan.h"
+#include "sha256.h"
+#include "snapshot.h"
+#include "timerwheel.h"
+#include "uring.h"
+#include "watch.h"
 #include "includes/dictionary.h"
 
 typedef struct {
@@ -28,7 +54,8 @@ typedef struct {
         DONE,
         INVALID_VERB,
         INVALID_FILE,
-        INCORRECT_DATA_AMOUNT
+        INCORRECT_DATA_AMOUNT,
+        OVERLOADED
     } state;
 
     int sock;
@@ -39,41 +66,93 @@ typedef struct {
     char header[1024];
     size_t file_size;
     bool size_read;
+    fanout* fanout; // Sub-server listings being gathered for LIST_ALL
+    sync_session* sync; // Catalog updates streamed by a sub-server over SYNC
+    bool replacing; // The PUT overwrites a file we already had
+    server_info registering; // Sub-server announcing its files with ADD_SERVER
+    vector* announced; // Names the ADD_SERVER listed so far, added to the catalog once the listing is complete
+    char* small_file; // Contents of a PUT that goes into a pack, gathered before it is stored
+    sha256_ctx* digest; // Hash of a PUT that is stored by its contents
+    bool compressing; // Sent ZGET or ZPUT, so the contents are preceded by their encoding
+    char encoding; // How the contents of a ZPUT arrive, 0 until it was read
+    bool stored_compressed; // The ZPUT is written as it arrives, as a stored compressed file
+    compress_stream* codec; // Compresses or decompresses the contents on their way
+    char* pending; // Output of `codec` not sent yet, from pending_start to pending_end
+    size_t pending_start;
+    size_t pending_end;
+    hotcache_entry* cached; // Contents of a GET answered from memory
+    fdcache_entry* open_file; // Where local_file of a GET came from, if it is shared with other GETs
+    uring_file* disk_writes; // Writes of a PUT on their way to disk, NULL if they are done synchronously
+    off_t file_written; // Bytes of the PUT handed to write so far, where the next ones go
+    bool received; // All contents of the PUT arrived
+    bool write_failed; // Some contents of the PUT did not make it to disk, so it must not be acknowledged
+    disk_job* disk_job; // Opening, storing or deleting the file on the disk pool
+    wheel_timer* deadline; // Drops the connection when it stops making progress
+    int unsent; // Bytes sent to the socket but not to the client when the deadline last passed
+    ratelimit_client* limit; // Bandwidth left to the client's address, NULL without a per-client limit
+    wheel_timer* resume; // Picks the transfer up again once the rate limits allow
+    bool paused; // Taken out of epoll until `resume` goes off
+    bool waiting_for_disk; // Taken out of epoll until its disk job or io_uring writes complete
+    bool admitted; // Counted against the concurrency limits
+    bool connected; // Counted against max_connections
+    bool local; // Connected over the Unix domain socket
+    bool passing_fd; // Sent FGET, so the file may go to the client as a descriptor instead of its contents
+    unsigned long upload_id; // Names the temporary file of a PUT or LINK, unlike the socket it is never reused
 } client_info;
 
-typedef struct {
-    char ip[INET_ADDRSTRLEN]; // IPv4 address
-    char port[6]; // Port as string (max 65535 + null)
-} server_info;
-
-void* server_info_copy_constructor(void* p) {
-    server_info* copy = malloc(sizeof(server_info));
-    strcpy(copy->ip, ((server_info*)p)->ip);
-    strcpy(copy->port, ((server_info*)p)->port);
-    return copy;
-}
-
-void* server_info_default_constructor() {
-    return calloc(1, sizeof(server_info));
-}
-
-static dictionary* file_to_server;
-static vector* mini_servers;
-// List of all sub-servers for round-robin PUT
+// Index into the sub-servers for round-robin PUT, 0 means this server
 static size_t current_server_index = 0;
 
 
 #define MAX_EVENTS 1000
+// Most bytes of an ADD_SERVER listing handled per event loop iteration, so other clients are not starved
+#define ADD_SERVER_READ_BUDGET (64 * 1024)
+// Buffers of compressed or decompressed output sent to a client at once
+#define CODEC_BUFFER_SIZE (64 * 1024)
+// Bytes a transfer may move per event loop iteration it is ready in, so a few large transfers cannot hold up every
+// other client (round robin by bytes); transfers of at most DEFAULT_BULK_SIZE get INTERACTIVE_WEIGHT times as much
+#define DEFAULT_QUANTUM (256 * 1024)
+#define DEFAULT_BULK_SIZE (1024 * 1024)
+#define INTERACTIVE_WEIGHT 4
+// Contents of a PUT read from the socket at once, and written to disk with one write
+#define PUT_BUFFER_SIZE (64 * 1024)
+// Seconds a client gets to send its verb and file name, to make progress on its request, and a SYNC connection to
+// send anything at all (sub-servers send a heartbeat every few seconds); 0 turns a deadline off
+#define DEFAULT_HEADER_TIMEOUT 10
+#define DEFAULT_TRANSFER_TIMEOUT 30
+#define DEFAULT_IDLE_TIMEOUT 60
+// Connections the kernel queues for us to accept, and how long a client turned away for being over a concurrency
+// limit is asked to wait before trying again
+#define DEFAULT_BACKLOG 128
+#define DEFAULT_RETRY_AFTER 1000
+// Most connections accepted per event loop iteration, so a connection storm cannot hold up the clients we already have
+#define ACCEPT_BATCH 64
 static bool run_server = true;
-static vector* files;
+static int epoll_fd;
+static int list_deadline = FANOUT_DEFAULT_DEADLINE;
+static unsigned header_timeout = DEFAULT_HEADER_TIMEOUT;
+static unsigned transfer_timeout = DEFAULT_TRANSFER_TIMEOUT;
+static unsigned idle_timeout = DEFAULT_IDLE_TIMEOUT;
+static size_t quantum = DEFAULT_QUANTUM; // 0 lets every transfer run until the socket is full or empty
+static size_t bulk_size = DEFAULT_BULK_SIZE; // 0 gives every transfer the same quantum
+static bool store_compressed = false; // Keep compressed uploads compressed on disk
+static size_t max_connections = 0; // Connections open at once, 0 for no limit; sub-server connections do not count
+static size_t max_requests = 0; // Requests handled at once, 0 for no limit; sub-server connections do not count
+static size_t max_gets = 0;
+static size_t max_puts = 0;
+static unsigned retry_after = DEFAULT_RETRY_AFTER;
+static size_t open_connections = 0;
+static size_t active_requests = 0;
+static size_t active_gets = 0;
+static size_t active_puts = 0;
+static unsigned long last_upload_id = 0;
 
 static void handler(int signum) {
-    if (signum == SIGINT) {
+    if (signum == SIGINT || signum == SIGTERM) {
         run_server = false;
     }
 }
 
-void set_nonblocking(int fd);
 ssize_t read_n_from_client(client_info* client, void* buf, ssize_t n);
 ssize_t write_n_to_client(const client_info* client, const void* buf, ssize_t n);
 verb parse_verb(client_info* client);
@@ -81,45 +160,452 @@ void read_file_name(client_info* client);
 void get(client_info* client);
 void put(client_info* client);
 void delete(client_info* client);
+void link_file(client_info* client);
 void list(client_info* client);
+void list_all(client_info* client);
+void sync_catalog(client_info* client);
 void add_server(client_info* client);
 void send_ok_msg_to_client(const client_info* client);
 void send_error_msg_to_client(const client_info* client);
 void send_invalid_req_msg_to_client(const client_info* client);
 void send_invalid_file_to_client(const client_info* client);
 void send_incorrect_data_msg_to_client(const client_info* client);
+void send_busy_msg_to_client(const client_info* client);
 void close_client_connection(const client_info* client);
 void* client_info_copy_constructor(void* p);
 
-ssize_t read_line_from_client(client_info* client, char* buffer, size_t size) {
-    size_t idx = 0;
+/**
+ * @brief Opens the Unix domain socket at `path` that clients on this host can use instead of TCP, replacing one a
+ * server that did not shut down cleanly left behind.
+ * @return the listening socket
+ */
+static int listen_local(const char* path, const int backlog) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Unix domain socket path too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, path);
+    const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        perror("socket() failed: Unix domain socket");
+        exit(1);
+    }
+    unlink(path);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, backlog) != 0) {
+        perror("bind() failed: Unix domain socket");
+        exit(1);
+    }
+    return sock;
+}
+
+/**
+ * @return the sooner of two epoll_wait timeouts, -1 meaning none
+ */
+static int sooner(const int a, const int b) {
+    if (a == -1 || b == -1) {
+        return a == -1 ? b : a;
+    }
+    return a < b ? a : b;
+}
+
+/**
+ * @brief Sets the deadline of `info` for the state it is in: the verb and file name have to arrive within
+ * header_timeout of connecting, after that the request may not go transfer_timeout without progress, and a SYNC
+ * connection not idle_timeout without hearing from the sub-server.
+ */
+static void arm_deadline(const client_info* info) {
+    unsigned timeout = header_timeout;
+    if (info->state == HANDLING_VERB) {
+        timeout = info->action == SYNC ? idle_timeout : transfer_timeout;
+    }
+    if (timeout == 0) {
+        timerwheel_cancel(info->deadline);
+    } else {
+        timerwheel_arm(info->deadline, timeout * 1000);
+    }
+}
 
-    while (idx < size - 1) {
-        if (read(client->sock, buffer + idx, 1) <= 0) return -1;
-        if (buffer[idx] == '\n') break;
-        ++idx;
+/**
+ * @brief Takes `bytes` the connection of `client` just moved out of its rate limits, and pushes back the deadline of
+ * its request. Until the request is read, the deadline stays where it is, so trickling in the header does not help.
+ */
+static void moved(const client_info* client, const size_t bytes) {
+    ratelimit_spend(client->limit, client->action, bytes);
+    if (client->state == HANDLING_VERB) {
+        arm_deadline(client);
     }
-    buffer[idx] = '\0';
-    return (ssize_t)idx;
 }
 
-int main(int argc, char** argv) {
-    file_to_server = dictionary_create(string_hash_function, string_compare, string_copy_constructor,
-                                       free, server_info_copy_constructor,
-                                       free); // Maps file name -> server_info*
-    mini_servers = vector_create(server_info_copy_constructor, free, server_info_default_constructor);
+/**
+ * @brief Counts the request of `client`, which was just read, against the concurrency limits. Connections of
+ * sub-servers (SYNC and ADD_SERVER) are always let in, so the catalog keeps up even while we are busy.
+ * @return false if it would go over one of them, in which case the client should be told to come back later
+ */
+static bool admit(client_info* client) {
+    if (client->action == SYNC || client->action == ADD_SERVER) {
+        if (client->connected) {
+            --open_connections;
+            client->connected = false;
+        }
+        return true;
+    }
+    if ((max_requests != 0 && active_requests >= max_requests) ||
+        (client->action == GET && max_gets != 0 && active_gets >= max_gets) ||
+        (client->action == PUT && max_puts != 0 && active_puts >= max_puts)) {
+        return false;
+    }
+    ++active_requests;
+    active_gets += client->action == GET;
+    active_puts += client->action == PUT;
+    client->admitted = true;
+    return true;
+}
+
+/**
+ * @brief Tells the connection `client`, which was just accepted over max_connections, to come back later and closes
+ * it. What it already sent is read first, so closing does not reset the connection before the client read our answer.
+ */
+static void refuse_connection(int client) {
+    char msg[64] = "ERROR\n";
+    const int len = 6 + snprintf(msg + 6, sizeof(msg) - 6, err_busy, retry_after);
+    if (write(client, msg, len) == -1) {
+        perror("write() failed: refusing client");
+    }
+    shutdown(client, SHUT_WR);
+    char discard[1024];
+    while (read(client, discard, sizeof(discard)) > 0) {
+    }
+    close(client);
+}
+
+/**
+ * @brief Takes `client` out of epoll until the rate limits let its transfer go on.
+ */
+static void pause_client(client_info* client) {
+    struct epoll_event ev = {.events = 0, .data.fd = client->sock};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->sock, &ev) == -1) {
+        perror("epoll_ctl() failed: pausing client sock");
+        exit(1);
+    }
+    client->paused = true;
+    timerwheel_arm(client->resume, ratelimit_wait(client->limit, client->action));
+}
+
+/**
+ * @brief Takes `client` out of epoll while it waits for the disk pool or io_uring, which put it back with
+ * disk_work_finished, so the event loop does not spin on it.
+ */
+static void wait_for_disk(client_info* client) {
+    struct epoll_event ev = {.events = 0, .data.fd = client->sock};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->sock, &ev) == -1) {
+        perror("epoll_ctl() failed: parking client sock");
+        exit(1);
+    }
+    client->waiting_for_disk = true;
+}
+
+/**
+ * @brief Puts `client` back into epoll if it was waiting for the disk. The socket may belong to another client by
+ * now, which then is not waiting.
+ * @param arg the client dictionary
+ */
+static void disk_work_finished(int client, void* arg) {
+    if (!dictionary_contains(arg, &client)) {
+        return;
+    }
+    client_info* info = dictionary_get(arg, &client);
+    if (!info->waiting_for_disk) {
+        return;
+    }
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.fd = client};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client, &ev) == -1) {
+        perror("epoll_ctl() failed: waking client sock");
+        exit(1);
+    }
+    info->waiting_for_disk = false;
+}
+
+/**
+ * @param arg the client dictionary
+ */
+static void client_resumed(int client, void* arg) {
+    client_info* info = dictionary_get(arg, &client);
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.fd = client};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client, &ev) == -1) {
+        perror("epoll_ctl() failed: resuming client sock");
+        exit(1);
+    }
+    info->paused = false;
+}
+
+/**
+ * @return bytes the transfer of `client` may move in this turn. Bulk transfers get one quantum, the rest
+ * INTERACTIVE_WEIGHT of them, so small GETs and PUTs finish in a turn or two while backups share what is left.
+ */
+static size_t turn_quantum(const client_info* client) {
+    if (quantum == 0) {
+        return SIZE_MAX;
+    }
+    return bulk_size != 0 && client->file_size > bulk_size ? quantum : quantum * INTERACTIVE_WEIGHT;
+}
+
+static size_t at_most(const size_t a, const size_t b) {
+    return a < b ? a : b;
+}
+
+/**
+ * @return bytes the transfer of `client` may move in this turn, within its quantum and the rate limits; 0 if it has
+ * to wait, in which case it was paused
+ */
+static size_t turn_budget(client_info* client) {
+    const size_t quantum_left = turn_quantum(client);
+    if (!ratelimit_enabled()) {
+        return quantum_left;
+    }
+    const size_t budget = ratelimit_allowance(client->limit, client->action, quantum_left);
+    if (budget < at_most(quantum_left, RATELIMIT_MIN_SEND)) {
+        pause_client(client);
+        return 0;
+    }
+    return budget;
+}
+
+/**
+ * @brief Ends the connection of `info` and forgets it, after sending an error if `send_reason` is given.
+ * @param send_reason sends the message that follows ERROR, NULL if the request ended normally
+ */
+static void drop_client(dictionary* client_dictionary, client_info* info,
+                        void (*send_reason)(const client_info* client)) {
+    if (send_reason != NULL) {
+        send_error_msg_to_client(info);
+        send_reason(info);
+    }
+    int client = info->sock;
+    close_client_connection(info);
+    dictionary_remove(client_dictionary, &client);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client, NULL) == -1) {
+        perror("epoll_ctl() failed: removing client sock");
+        exit(1);
+    }
+    close(client);
+}
+
+/**
+ * @brief Drops `client` when its deadline passed, unless it is waiting for our disk or rate limits, or still reading
+ * what the socket holds.
+ * @param arg the client dictionary
+ */
+static void client_timed_out(int client, void* arg) {
+    dictionary* client_dictionary = arg;
+    client_info* info = dictionary_get(client_dictionary, &client);
+    if (info->paused || info->waiting_for_disk || info->disk_job != NULL ||
+        (info->received && info->disk_writes != NULL)) {
+        arm_deadline(info);
+        return;
+    }
+    /* A slow client can take longer than the deadline to read what fits in the socket buffer */
+    int unsent;
+    if (ioctl(client, SIOCOUTQ, &unsent) == 0 && unsent > 0 && unsent != info->unsent) {
+        info->unsent = unsent;
+        arm_deadline(info);
+        return;
+    }
+    LOG("dropping client %d, it stopped making progress", client);
+    drop_client(client_dictionary, info, NULL);
+}
 
-    if (argc < 2) {
+int main(int argc, char** argv) {
+    size_t rebalance_rate = REBALANCE_DEFAULT_RATE;
+    char* main_server = NULL; // <host>:<port> of the main server if we are a sub-server
+    char* advertise_ip = NULL;
+    size_t scan_threads = SCAN_DEFAULT_THREADS;
+    unsigned snapshot_interval = SNAPSHOT_DEFAULT_INTERVAL;
+    char* migrate_to = NULL; // Layout to convert Pi-Share to, instead of serving it
+    size_t pack_threshold = 0;
+    bool dedup = false;
+    size_t cache_size = 0;
+    size_t fd_cache_size = FDCACHE_DEFAULT_SIZE;
+    unsigned pull_after = 0;
+    size_t pull_cache_size = PULLCACHE_DEFAULT_SIZE;
+    bool io_uring = false;
+    size_t disk_threads = DISKPOOL_DEFAULT_THREADS;
+    size_t rate_limit = 0, get_rate_limit = 0, put_rate_limit = 0, client_rate_limit = 0;
+    int backlog = DEFAULT_BACKLOG;
+    int defer_accept = 0;
+    int send_buffer = 0, receive_buffer = 0;
+    char* local_path = NULL;
+    static struct option long_options[] = {
+        {"rebalance-rate", required_argument, NULL, 'r'},
+        {"list-deadline", required_argument, NULL, 'l'},
+        {"main", required_argument, NULL, 'm'},
+        {"advertise", required_argument, NULL, 'a'},
+        {"scan-threads", required_argument, NULL, 't'},
+        {"snapshot-interval", required_argument, NULL, 's'},
+        {"migrate", required_argument, NULL, 'M'},
+        {"pack-threshold", required_argument, NULL, 'p'},
+        {"dedup", no_argument, NULL, 'd'},
+        {"store-compressed", no_argument, NULL, 'c'},
+        {"cache-size", required_argument, NULL, 'C'},
+        {"fd-cache", required_argument, NULL, 'F'},
+        {"pull-after", required_argument, NULL, 'P'},
+        {"pull-cache-size", required_argument, NULL, 'S'},
+        {"io-uring", no_argument, NULL, 'u'},
+        {"disk-threads", required_argument, NULL, 'D'},
+        {"header-timeout", required_argument, NULL, 'H'},
+        {"transfer-timeout", required_argument, NULL, 'T'},
+        {"idle-timeout", required_argument, NULL, 'I'},
+        {"quantum", required_argument, NULL, 'Q'},
+        {"bulk-size", required_argument, NULL, 'B'},
+        {"rate-limit", required_argument, NULL, 'R'},
+        {"get-rate-limit", required_argument, NULL, 'g'},
+        {"put-rate-limit", required_argument, NULL, 'w'},
+        {"client-rate-limit", required_argument, NULL, 'i'},
+        {"backlog", required_argument, NULL, 'b'},
+        {"max-connections", required_argument, NULL, 'N'},
+        {"max-requests", required_argument, NULL, 'n'},
+        {"max-gets", required_argument, NULL, 'G'},
+        {"max-puts", required_argument, NULL, 'U'},
+        {"retry-after", required_argument, NULL, 'y'},
+        {"defer-accept", required_argument, NULL, 'e'},
+        {"send-buffer", required_argument, NULL, 'o'},
+        {"receive-buffer", required_argument, NULL, 'v'},
+        {"unix", required_argument, NULL, 'x'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            rebalance_rate = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            list_deadline = atoi(optarg);
+            break;
+        case 'm':
+            main_server = optarg;
+            break;
+        case 'a':
+            advertise_ip = optarg;
+            break;
+        case 't':
+            scan_threads = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            snapshot_interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'M':
+            migrate_to = optarg;
+            break;
+        case 'p':
+            pack_threshold = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            dedup = true;
+            break;
+        case 'c':
+            store_compressed = true;
+            break;
+        case 'C':
+            cache_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'F':
+            fd_cache_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'P':
+            pull_after = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            pull_cache_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'u':
+            io_uring = true;
+            break;
+        case 'D':
+            disk_threads = strtoul(optarg, NULL, 10);
+            break;
+        case 'H':
+            header_timeout = strtoul(optarg, NULL, 10);
+            break;
+        case 'T':
+            transfer_timeout = strtoul(optarg, NULL, 10);
+            break;
+        case 'I':
+            idle_timeout = strtoul(optarg, NULL, 10);
+            break;
+        case 'Q':
+            quantum = strtoul(optarg, NULL, 10);
+            break;
+        case 'B':
+            bulk_size = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            rate_limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'g':
+            get_rate_limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            put_rate_limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            client_rate_limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            backlog = atoi(optarg);
+            break;
+        case 'N':
+            max_connections = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            max_requests = strtoul(optarg, NULL, 10);
+            break;
+        case 'G':
+            max_gets = strtoul(optarg, NULL, 10);
+            break;
+        case 'U':
+            max_puts = strtoul(optarg, NULL, 10);
+            break;
+        case 'y':
+            retry_after = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            defer_accept = atoi(optarg);
+            break;
+        case 'o':
+            send_buffer = atoi(optarg);
+            break;
+        case 'v':
+            receive_buffer = atoi(optarg);
+            break;
+        case 'x':
+            local_path = optarg;
+            break;
+        default:
+            print_server_usage();
+            exit(1);
+        }
+    }
+    if (migrate_to != NULL) {
+        if (strcmp(migrate_to, "hashed") != 0 && strcmp(migrate_to, "flat") != 0) {
+            print_server_usage();
+            exit(1);
+        }
+        exit(layout_migrate("Pi-Share", strcmp(migrate_to, "hashed") == 0));
+    }
+    if (optind >= argc) {
         print_server_usage();
         exit(1);
     }
+    char* port = argv[optind];
+    catalog_init();
 
     struct sigaction sa;
 
     sa.sa_handler = handler;
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = SA_RESTART;
-    if (sigaction(SIGINT, &sa, NULL) == -1) {
+    if (sigaction(SIGINT, &sa, NULL) == -1 || sigaction(SIGTERM, &sa, NULL) == -1) {
         perror("sigaction() failed");
         exit(1);
     }
@@ -134,24 +620,38 @@ int main(int argc, char** argv) {
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
 
-    const int status = getaddrinfo(NULL, argv[1], &hints, &res);
+    const int status = getaddrinfo(NULL, port, &hints, &res);
     if (status != 0) {
         fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
     }
 
-    const int sock = socket(AF_INET, SOCK_STREAM, 0);
+    const int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sock == -1) {
         perror("socket() failed");
         freeaddrinfo(res);
         exit(1);
     }
 
-    int opt = 1;
+    opt = 1;
     if (setsockopt(sock, SOL_SOCKET,SO_REUSEADDR, &opt, sizeof(opt)) == -1 ||
         setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1) {
         perror("setsockopt() failed");
         exit(1);
     }
+    /* Accepted connections inherit these. Headers go out in one piece, so there is nothing for Nagle to coalesce */
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt)) == -1) {
+        perror("setsockopt(TCP_NODELAY) failed");
+    }
+    /* Fixed sizes turn off the kernel's autotuning, for links whose bandwidth-delay product it does not reach */
+    if ((send_buffer > 0 && setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer)) == -1) ||
+        (receive_buffer > 0 &&
+         setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer)) == -1)) {
+        perror("setsockopt(SO_SNDBUF/SO_RCVBUF) failed");
+    }
+    /* Connections are only handed to us once the request arrived, or after defer_accept seconds without one */
+    if (defer_accept > 0 && setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &defer_accept, sizeof(defer_accept)) == -1) {
+        perror("setsockopt(TCP_DEFER_ACCEPT) failed");
+    }
 
     if (bind(sock, res->ai_addr, res->ai_addrlen) != 0) {
         perror("bind() failed");
@@ -161,13 +661,14 @@ int main(int argc, char** argv) {
 
     freeaddrinfo(res);
 
-    if (listen(sock, 10) != 0) {
+    if (listen(sock, backlog) != 0) {
         perror("listen() failed");
         exit(1);
     }
+    const int local_sock = local_path != NULL ? listen_local(local_path, backlog) : -1;
 
 
-    const int epoll_fd = epoll_create1(0);
+    epoll_fd = epoll_create1(0);
     if (epoll_fd == -1) {
         perror("epoll_create1() failed");
         exit(1);
@@ -181,11 +682,17 @@ int main(int argc, char** argv) {
         perror("epoll_ctl() failed: server sock");
         exit(1);
     }
+    if (local_sock != -1) {
+        ev.data.fd = local_sock;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, local_sock, &ev) == -1) {
+            perror("epoll_ctl() failed: Unix domain socket");
+            exit(1);
+        }
+    }
 
     dictionary* client_dictionary = dictionary_create(int_hash_function, int_compare, int_copy_constructor,
                                                       int_destructor, client_info_copy_constructor, free);
 
-    files = string_vector_create();
     char* orig_dir = get_current_dir_name();
     char pi_share_dir[9] = "Pi-Share";
     if (mkdir(pi_share_dir, 0777) == -1 && errno != EEXIST) {
@@ -193,55 +700,138 @@ int main(int argc, char** argv) {
         exit(1);
     }
     print_temp_directory(pi_share_dir);
-
-    // Pi share scraping code
-    struct dirent* entry;
-    DIR* dir = opendir(pi_share_dir);
-    if (dir == NULL) {
-        perror("opendir() failed");
+    layout_init(pi_share_dir);
+    layout_ingest_all(pi_share_dir);
+    pack_init(pi_share_dir, pack_threshold);
+    dedup_init(pi_share_dir, dedup);
+    hotcache_init(cache_size);
+    fdcache_init(fd_cache_size);
+    pullcache_init(pi_share_dir, pull_after, pull_cache_size);
+
+    /* The snapshot lives next to Pi-Share, so it is not mistaken for a shared file */
+    char* snapshot_path;
+    char* pi_share_path;
+    asprintf(&snapshot_path, "%s/%s.catalog", orig_dir, pi_share_dir);
+    asprintf(&pi_share_path, "%s/%s", orig_dir, pi_share_dir);
+    const bool restored = snapshot_load(snapshot_path);
+    if (!restored && scan_local_files(pi_share_dir, scan_threads) == -1) {
+        perror("scanning Pi-Share failed");
         exit(1);
     }
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    /* Picks up files other processes put into Pi-Share while we run */
+    const int share_watch = watch_start(pi_share_dir, scan_threads);
+    if (share_watch != -1) {
+        ev.events = EPOLLIN;
+        ev.data.fd = share_watch;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, share_watch, &ev) == -1) {
+            perror("epoll_ctl() failed: inotify watch");
+            exit(1);
+        }
+    }
+
+    if (io_uring) {
+        if (uring_init()) {
+            ev.events = EPOLLIN;
+            ev.data.fd = uring_event_fd();
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, uring_event_fd(), &ev) == -1) {
+                perror("epoll_ctl() failed: io_uring");
+                exit(1);
+            }
+        } else {
+            perror("io_uring_setup() failed, writing uploads synchronously");
         }
-        struct stat entry_stat;
-        char full_path[1024];
-        snprintf(full_path, sizeof(full_path), "%s/%s", pi_share_dir, entry->d_name);
-        if (stat(full_path, &entry_stat) == 0 && S_ISREG(entry_stat.st_mode)) {
-            vector_push_back(files, entry->d_name);
+    }
+
+    diskpool_init(disk_threads);
+    ratelimit_init(rate_limit, get_rate_limit, put_rate_limit, client_rate_limit);
+    if (diskpool_event_fd() != -1) {
+        ev.events = EPOLLIN;
+        ev.data.fd = diskpool_event_fd();
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, diskpool_event_fd(), &ev) == -1) {
+            perror("epoll_ctl() failed: disk pool");
+            exit(1);
         }
     }
-    closedir(dir);
-    // End of scraping code
 
     chdir(pi_share_dir);
+    /* A restored catalog is checked against Pi-Share in the background, while we already serve requests */
+    snapshot_start(snapshot_path, snapshot_interval, restored ? pi_share_path : NULL, scan_threads);
+    pack_start_compaction();
+    dedup_start_sweeper();
+    rebalance_init(rebalance_rate);
+    if (main_server != NULL) {
+        char* main_port = strchr(main_server, ':');
+        if (main_port == NULL) {
+            print_server_usage();
+            exit(1);
+        }
+        *main_port++ = '\0';
+        catalog_sync_start(main_server, main_port, port, advertise_ip);
+    }
     // ReSharper disable once CppDFALoopConditionNotUpdated
     while (run_server) {
-        const int num_fds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        const int num_fds =
+            epoll_wait(epoll_fd, events, MAX_EVENTS, sooner(fanout_next_timeout(), timerwheel_next_timeout()));
         if (num_fds == -1) {
             perror("epoll_wait() failed");
         }
         for (int i = 0; i < num_fds; ++i) {
-            if (events[i].data.fd == sock) { /* There is a new connection */
-                struct sockaddr_in addr = {0};
-                socklen_t addrlen = sizeof(addr);
-                int client = accept(sock, (struct sockaddr*)&addr, &addrlen);
-                if (client == -1) {
-                    perror("accept() failed");
-                }
-                set_nonblocking(client);
-                ev.events = EPOLLIN | EPOLLOUT; // | EPOLLET;
-                ev.data.fd = client;
-                if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client, &ev) == -1) {
-                    perror("epoll_ctl() failed: client sock");
-                    exit(1);
+            if (events[i].data.fd == sock || events[i].data.fd == local_sock) { /* New connections, take all waiting */
+                for (int accepted = 0; accepted < ACCEPT_BATCH; ++accepted) {
+                    struct sockaddr_storage addr = {0};
+                    socklen_t addrlen = sizeof(addr);
+                    int client = accept4(events[i].data.fd, (struct sockaddr*)&addr, &addrlen,
+                                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (client == -1) {
+                        if (errno == ECONNABORTED) { /* Gave up while waiting, the next one may still be there */
+                            continue;
+                        }
+                        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                            perror("accept4() failed");
+                        }
+                        break;
+                    }
+                    if (max_connections != 0 && open_connections >= max_connections) {
+                        refuse_connection(client);
+                        continue;
+                    }
+                    ev.events = EPOLLIN | EPOLLOUT; // | EPOLLET;
+                    ev.data.fd = client;
+                    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client, &ev) == -1) {
+                        perror("epoll_ctl() failed: client sock");
+                        exit(1);
+                    }
+                    client_info info = {.state = READING_VERB, .sock = client, .action = V_UNKNOWN,
+                                        .local = addr.ss_family == AF_UNIX, .upload_id = ++last_upload_id,
+                                        .connected = true};
+                    ++open_connections;
+                    /* Clients on this host share the rate limit of one address */
+                    char ip[INET_ADDRSTRLEN] = "local";
+                    if (addr.ss_family == AF_INET) {
+                        inet_ntop(AF_INET, &((struct sockaddr_in*)&addr)->sin_addr, ip, sizeof(ip));
+                    }
+                    info.limit = ratelimit_connect(ip);
+                    info.deadline = timerwheel_timer_create(client_timed_out, client);
+                    info.resume = timerwheel_timer_create(client_resumed, client);
+                    arm_deadline(&info);
+                    dictionary_set(client_dictionary, &client, &info);
                 }
-                client_info info = {READING_VERB, client, 0, V_UNKNOWN, 0, 0, {0}, 0,false};
-                dictionary_set(client_dictionary, &client, &info);
+            } else if (events[i].data.fd == share_watch) { /* Files changed in Pi-Share */
+                watch_handle_events();
+            } else if (events[i].data.fd == uring_event_fd()) { /* Uploads were written */
+                uring_handle_completions(disk_work_finished, client_dictionary);
+            } else if (events[i].data.fd == diskpool_event_fd()) { /* File work finished, handlers check on it */
+                diskpool_handle_completions(disk_work_finished, client_dictionary);
+            } else if (fanout_owns(events[i].data.fd)) { /* A sub-server answering a LIST_ALL */
+                fanout_handle_event(events[i].data.fd, events[i].events);
             } else {
                 int client = events[i].data.fd;
                 client_info* info = dictionary_get(client_dictionary, &client);
+                const bool was_handling = info->state == HANDLING_VERB;
+                /* Only hang-ups and errors are reported while paused or waiting for the disk */
+                if (info->paused || info->waiting_for_disk) {
+                    info->state = INCORRECT_DATA_AMOUNT;
+                }
                 switch (info->state) {
                 case READING_VERB:
                     info->action = parse_verb(info);
@@ -268,71 +858,55 @@ int main(int argc, char** argv) {
                     case ADD_SERVER:
                         add_server(info);
                         break;
+                    case LIST_ALL:
+                        list_all(info);
+                        break;
+                    case SYNC:
+                        sync_catalog(info);
+                        break;
+                    case LINK:
+                        link_file(info);
+                        break;
                     }
                     break;
                 }
                 default: /* Not possible to reach the DONE or ERROR state here */
                     break;
                 }
-                if (info->state == DONE) {
-                    close_client_connection(info);
-                    dictionary_remove(client_dictionary, &client);
-                    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client, NULL) == -1) {
-                        perror("epoll_ctl() failed: removing client sock");
-                        exit(1);
+                if (info->state == HANDLING_VERB && !was_handling) {
+                    if (admit(info)) {
+                        arm_deadline(info);
+                    } else {
+                        info->state = OVERLOADED;
                     }
+                }
+                if (info->state == DONE) {
+                    drop_client(client_dictionary, info, NULL);
                 } else if (info->state == INVALID_VERB) {
                     /* There could have been an error when handling something else */
-                    send_error_msg_to_client(info);
-                    send_invalid_req_msg_to_client(info);
-                    close_client_connection(info);
-                    dictionary_remove(client_dictionary, &client);
-                    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client, NULL) == -1) {
-                        perror("epoll_ctl() failed: removing client sock");
-                        exit(1);
-                    }
+                    drop_client(client_dictionary, info, send_invalid_req_msg_to_client);
                 } else if (info->state == INVALID_FILE) {
-                    send_error_msg_to_client(info);
-                    send_invalid_file_to_client(info);
-                    close_client_connection(info);
-                    dictionary_remove(client_dictionary, &client);
-                    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client, NULL) == -1) {
-                        perror("epoll_ctl() failed: removing client sock");
-                        exit(1);
-                    }
+                    drop_client(client_dictionary, info, send_invalid_file_to_client);
                 } else if (info->state == INCORRECT_DATA_AMOUNT) {
-                    send_error_msg_to_client(info);
-                    send_incorrect_data_msg_to_client(info);
-                    close_client_connection(info);
-                    dictionary_remove(client_dictionary, &client);
-                    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client, NULL) == -1) {
-                        perror("epoll_ctl() failed: removing client sock");
-                        exit(1);
-                    }
+                    drop_client(client_dictionary, info, send_incorrect_data_msg_to_client);
+                } else if (info->state == OVERLOADED) {
+                    drop_client(client_dictionary, info, send_busy_msg_to_client);
                 }
             }
         }
+        timerwheel_expire(client_dictionary);
     }
     dictionary_destroy(client_dictionary);
-    vector_destroy(files);
+    snapshot_save(snapshot_path);
+    catalog_destroy();
     chdir(orig_dir);
-    free(orig_dir);
-}
-
-/**
- * @brief Configures a file descriptor to operate in non-blocking mode.
- * @param fd File descriptor to be set to non-blocking.
- */
-void set_nonblocking(const int fd) {
-    const int flags = fcntl(fd, F_GETFL, 0);
-    if (flags == -1) {
-        perror("fcntl(F_GETFL) failed");
-        exit(1);
-    }
-    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        perror("fcntl(F_SETFL) failed");
-        exit(1);
+    if (local_sock != -1) {
+        close(local_sock);
+        unlink(local_path);
     }
+    free(snapshot_path);
+    free(pi_share_path);
+    free(orig_dir);
 }
 
 /**
@@ -355,6 +929,7 @@ ssize_t read_n_from_client(client_info* client, void* buf, const ssize_t n) {
             return -2; /* There was some other error */
         }
         num_read += res;
+        moved(client, res);
         if (res == 0 && num_read < n) {
             client->buffer_position += num_read;
             return -1; /* We hit EOF before reading all the bytes we were expecting */
@@ -367,15 +942,63 @@ ssize_t read_n_from_client(client_info* client, void* buf, const ssize_t n) {
 ssize_t write_n_to_client(const client_info* client, const void* buf, ssize_t n) {
     ssize_t num_written = 0;
     while (num_written != n) {
-        const ssize_t res = write(client->sock, buf, n);
+        const ssize_t res = write(client->sock, buf + num_written, n - num_written);
         if (res == -1 || res == 0) {
             break;
         }
         num_written += res;
+        moved(client, res);
     }
     return num_written;
 }
 
+/**
+ * @brief Sends the pieces of a response header with one sendmsg, so they leave in one packet instead of one each.
+ * @param more contents follow right away, so the kernel may hold the header back to send it along with them
+ * @return whether all of it was sent
+ */
+static bool write_parts_to_client(const client_info* client, struct iovec* parts, const int count, const bool more) {
+    size_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        total += parts[i].iov_len;
+    }
+    struct msghdr msg = {.msg_iov = parts, .msg_iovlen = count};
+    const ssize_t sent = sendmsg(client->sock, &msg, more ? MSG_MORE : 0);
+    if (sent > 0) {
+        moved(client, sent);
+    }
+    return sent == (ssize_t)total;
+}
+
+/**
+ * @brief Sends `parts` like write_parts_to_client, with a duplicate of `fd` attached to them (SCM_RIGHTS). The client
+ * has to read the first byte of `parts` with recvmsg to get it.
+ * @return whether all of it was sent
+ */
+static bool pass_fd_to_client(const client_info* client, struct iovec* parts, const int count, const int fd) {
+    size_t total = 0;
+    for (int i = 0; i < count; ++i) {
+        total += parts[i].iov_len;
+    }
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control = {0};
+    struct msghdr msg = {
+        .msg_iov = parts, .msg_iovlen = count, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)
+    };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    const ssize_t sent = sendmsg(client->sock, &msg, 0);
+    if (sent > 0) {
+        moved(client, sent);
+    }
+    return sent == (ssize_t)total;
+}
+
 /**
  * @brief Determines the verb the client is using, will update the client's state depending on the request content.
  * Also, resets header and buffer_position if the verb is determined and further header data needs to be read.
@@ -403,6 +1026,12 @@ verb parse_verb(client_info* client) {
             client->state = INVALID_VERB;
             return V_UNKNOWN;
         }
+    } else if (pos < 9) { /* Can't tell if we have 'LIST_ALL\n' yet */
+        ssize_t res = read_n_from_client(client, client->header, 9 - pos);
+        if (res == -1 || res == -2) {
+            client->state = INVALID_VERB;
+            return V_UNKNOWN;
+        }
     } else if (pos < 11) { /* Can't tell if we have 'ADD_SERVER\n' yet */
         ssize_t res = read_n_from_client(client, client->header, 11 - pos);
         if (res == -1 || res == -2) {
@@ -431,12 +1060,43 @@ verb parse_verb(client_info* client) {
         client->state = HANDLING_VERB;
         return LIST;
     }
+    if (pos == 5 && strncmp(client->header, "SYNC ", 5) == 0) {
+        memset(client->header, 0, client->buffer_position);
+        client->buffer_position = 0;
+        client->state = READING_HEADER;
+        return SYNC;
+    }
+    if (pos == 5 && (strncmp(client->header, "ZGET ", 5) == 0 || strncmp(client->header, "ZPUT ", 5) == 0)) {
+        const verb action = client->header[1] == 'G' ? GET : PUT;
+        memset(client->header, 0, client->buffer_position);
+        client->buffer_position = 0;
+        client->state = READING_HEADER;
+        client->compressing = true;
+        return action;
+    }
+    if (pos == 5 && strncmp(client->header, "FGET ", 5) == 0) {
+        memset(client->header, 0, client->buffer_position);
+        client->buffer_position = 0;
+        client->state = READING_HEADER;
+        client->passing_fd = true;
+        return GET;
+    }
+    if (pos == 5 && strncmp(client->header, "LINK ", 5) == 0) {
+        memset(client->header, 0, client->buffer_position);
+        client->buffer_position = 0;
+        client->state = READING_HEADER;
+        return LINK;
+    }
     if (pos == 7 && strncmp(client->header, "DELETE ", 7) == 0) {
         memset(client->header, 0, client->buffer_position);
         client->buffer_position = 0;
         client->state = READING_HEADER;
         return DELETE;
     }
+    if (pos == 9 && strncmp(client->header, "LIST_ALL\n", 9) == 0) {
+        client->state = HANDLING_VERB;
+        return LIST_ALL;
+    }
     if (pos == 11 && strncmp(client->header, "ADD_SERVER ", 11) == 0) {
         memset(client->header, 0, client->buffer_position);
         client->buffer_position = 0;
@@ -477,70 +1137,522 @@ void read_file_name(client_info* client) {
 }
 
 /**
- * @brief Completes a GET request for a client.
- * Only to be used after `parse_verb` and `read_file_name` have succeeded on this client.
- * `client->header` contains the requested file name and `client->buffer_position` is the length of the string.
- * @param client client that has a GET request
+ * @brief Sends the rest of a GET through `client->codec`, one turn at a time.
+ * @return true once everything was sent (or the transfer failed), false to be called again later
  */
-void get(client_info* client) {
-    //check the dictionary for the file name, if it exists, then get the server info from the dictionary
-    //send that server info the client
-    //change the client state to stateDone
-
-    /* Check if the file exists */
-    // First: check if main server has it
-    bool file_found = false;
-    VECTOR_FOR_EACH(
-        files, f,
-        if (strcmp(f, client->header) == 0) {
-        file_found = true;
-        break;
+static bool send_through_codec(client_info* client) {
+    if (client->pending == NULL) {
+        client->pending = malloc(CODEC_BUFFER_SIZE);
+    }
+    for (size_t budget = turn_budget(client); budget > 0;) {
+        if (client->pending_start == client->pending_end) {
+            off_t pos = client->local_file_pos;
+            const ssize_t produced = compress_stream_read(client->codec, client->local_file, &pos,
+                                                          (off_t)client->file_size, client->pending,
+                                                          CODEC_BUFFER_SIZE);
+            client->local_file_pos = pos;
+            if (produced <= 0) {
+                return true; /* Done, or the stored file is damaged and the client gets less than announced */
+            }
+            client->pending_start = 0;
+            client->pending_end = produced;
         }
-    );
-    if (file_found) {
-        // Serve locally
-        send_ok_msg_to_client(client);
-        write_n_to_client(client, "0.0.0.0\n0\n", 10);
-        client->local_file = open(client->header, O_RDONLY);
-        struct stat s;
-        fstat(client->local_file, &s);
-        const size_t file_size = s.st_size;
-        if (write_n_to_client(client, &file_size, sizeof(file_size)) != sizeof(file_size)) {
-            client->state = INCORRECT_DATA_AMOUNT;
-            return;
+        const ssize_t sent = write(client->sock, client->pending + client->pending_start,
+                                   at_most(client->pending_end - client->pending_start, budget));
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
         }
+        if (sent <= 0) {
+            return true;
+        }
+        client->pending_start += sent;
+        budget -= sent;
+        moved(client, sent);
+    }
+    return false; /* Let the other clients have their turn */
+}
 
-        char buffer[1024];
-        ssize_t read_result = 0;
-        do {
-            read_result = read(client->local_file, buffer, 1024);
-            if (read_result > 0) {
-                write_n_to_client(client, buffer, read_result);
-            }
-        } while (read_result > 0);
+/**
+ * @brief Closes `client->local_file`, or gives it back to the fd cache if it came from there.
+ */
+static void release_local_file(const client_info* client) {
+    if (client->open_file != NULL) {
+        fdcache_release(client->open_file);
+    } else if (client->local_file > 0) {
+        close(client->local_file);
+    }
+}
 
-        client->state = DONE;
-        return;
+/**
+ * @brief Sends the whole response to a GET of a file in the hot file cache, header and contents in one writev,
+ * continuing where the last call stopped.
+ * @return true once everything was sent (or the client is gone), false to be called again later
+ */
+static bool send_cached(client_info* client) {
+    char header[32] = "OK\n0.0.0.0\n0\n";
+    size_t header_size = strlen(header);
+    if (client->compressing || client->passing_fd) {
+        header[header_size++] = COMPRESS_RAW;
+    }
+    const size_t size = hotcache_size(client->cached);
+    memcpy(header + header_size, &size, sizeof(size));
+    header_size += sizeof(size);
+    /* local_file_pos counts the bytes of header and contents sent so far */
+    size_t budget = turn_budget(client);
+    while ((size_t)client->local_file_pos < header_size + size) {
+        if (budget == 0) {
+            return false; /* Let the other clients have their turn */
+        }
+        const size_t pos = client->local_file_pos;
+        const size_t data_pos = pos < header_size ? 0 : pos - header_size;
+        struct iovec iov[2];
+        int count = 0;
+        if (pos < header_size) {
+            iov[count++] = (struct iovec){header + pos, header_size - pos};
+        }
+        iov[count++] = (struct iovec){(char*)hotcache_data(client->cached) + data_pos,
+                                      at_most(size - data_pos, budget)};
+        const ssize_t sent = writev(client->sock, iov, count);
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        }
+        if (sent <= 0) {
+            return true;
+        }
+        client->local_file_pos += sent;
+        budget -= at_most(sent, budget);
+        moved(client, sent);
     }
+    return true;
+}
 
-    // Otherwise: check dictionary and redirect
-    server_info* info;
-    if (dictionary_contains(file_to_server, client->header)) {
-        info = dictionary_get(file_to_server, client->header);
-    } else {
+/**
+ * @brief Sends the client of a GET for a file we do not have to the sub-server that has it.
+ */
+static void redirect_get(client_info* client) {
+    server_info info;
+    if (!catalog_lookup_remote(client->header, &info)) {
         send_invalid_file_to_client(client);
         client->state = DONE;
         return;
     }
-    send_ok_msg_to_client(client);
     char msg[64];
-    snprintf(msg, sizeof(msg), "%s\n%s\n", info->ip, info->port);
+    snprintf(msg, sizeof(msg), "OK\n%s\n%s\n", info.ip, info.port);
     write_n_to_client(client, msg, strlen(msg));
+    pullcache_redirected(client->header, &info);
 
+    client->state = DONE;
+}
+
+/**
+ * @brief What opening the file of a GET on the disk pool found out.
+ */
+typedef struct {
+    char name[1024];
+    bool compressing; // The client takes compressed contents
+    int fd; // In: our copy of a sub-server's file or -1. Out: the file, -1 if it is gone
+    fdcache_entry* open_file; // Where `fd` came from, if it is shared with other GETs
+    off_t offset; // The contents are the `size` bytes of `fd` starting at `offset`
+    bool packed; // `fd` is a pack, which holds other files too
+    size_t size;
+    size_t raw_size; // Size of the contents once decompressed
+    bool stored_compressed;
+    bool compressible;
+    hotcache_entry* cached; // The contents, if they were read into the hot file cache
+} get_open;
+
+/**
+ * @brief Opens the file of a GET and looks into it, which may wait for the disk.
+ */
+static void open_for_get(void* data) {
+    get_open* job = data;
+    const unsigned long generation = hotcache_generation();
+    if (job->fd == -1) {
+        job->fd = pack_open(job->name, &job->offset, &job->size);
+        job->packed = job->fd != -1;
+    }
+    if (job->fd == -1) {
+        job->open_file = fdcache_open(job->name);
+        if (job->open_file == NULL) {
+            return;
+        }
+        job->fd = fdcache_fd(job->open_file);
+        job->size = fdcache_stat(job->open_file)->st_size;
+    }
+    job->raw_size = job->size;
+    if (!job->packed && compress_is_stored(job->fd, &job->raw_size)) {
+        job->stored_compressed = true;
+        return;
+    }
+    /* Small files are kept in memory for the next GET, unless they are still being written */
+    const bool cacheable = hotcache_wants(job->size) && !catalog_is_being_written(job->name);
+    job->compressible = (job->compressing || cacheable) && compress_worthwhile(job->fd, job->offset, job->size);
+    if (cacheable) {
+        job->cached = hotcache_fill(job->name, job->fd, job->offset, job->size, job->compressible, generation);
+    }
+}
+
+static void discard_open_for_get(void* data) {
+    const get_open* job = data;
+    if (job->open_file != NULL) {
+        fdcache_release(job->open_file);
+    } else if (job->fd != -1) {
+        close(job->fd);
+    }
+    if (job->cached != NULL) {
+        hotcache_release(job->cached);
+    }
+}
+
+/**
+ * @brief Takes over the file opened by open_for_get and sends the beginning of the response.
+ * @return false if the GET failed (see state)
+ */
+static bool start_get(client_info* client, const get_open* job) {
+    if (job->fd == -1) {
+        /* A restored catalog can list files that are gone until it is reconciled */
+        catalog_remove_local(client->header);
+        client->state = INVALID_FILE;
+        return false;
+    }
+    client->local_file = job->fd;
+    client->open_file = job->open_file;
+    client->cached = job->cached;
+    /*
+     * Stored compressed files go out as they are to clients that take compressed contents, and are
+     * decompressed for the others. Other files are compressed on the way if that looks worth it.
+     */
+    char encoding = COMPRESS_RAW;
+    if (job->stored_compressed) {
+        if (client->compressing) {
+            encoding = COMPRESS_ZLIB;
+        } else {
+            client->codec = compress_stream_create(false, 0);
+        }
+    } else if (client->compressing && job->compressible) {
+        encoding = COMPRESS_ZLIB;
+        client->codec = compress_stream_create(true, COMPRESS_FAST_LEVEL);
+    } else if (client->passing_fd && client->local && !job->packed) {
+        encoding = FGET_PASSED_FD;
+    } else if (client->cached != NULL) {
+        release_local_file(client);
+        client->local_file = -1;
+        client->open_file = NULL;
+        return true; /* Sent from memory, header and all */
+    }
+    if (client->cached != NULL) {
+        hotcache_release(client->cached);
+        client->cached = NULL;
+    }
+    struct iovec header[] = {
+        {"OK\n0.0.0.0\n0\n", 13},
+        {&encoding, client->compressing || client->passing_fd ? 1 : 0},
+        {(void*)&job->raw_size, sizeof(job->raw_size)}
+    };
+    if (encoding == FGET_PASSED_FD) {
+        /* The client copies the file itself, nothing is left to send */
+        client->local_file_pos = client->file_size = job->size;
+        if (!write_parts_to_client(client, header, 1, false) || !pass_fd_to_client(client, header + 1, 2, job->fd)) {
+            client->state = INCORRECT_DATA_AMOUNT;
+            return false;
+        }
+        return true;
+    }
+    if (!write_parts_to_client(client, header, 3, job->size > 0 || client->codec != NULL)) {
+        client->state = INCORRECT_DATA_AMOUNT;
+        return false;
+    }
+    /* The contents are the bytes [local_file_pos, file_size) of local_file */
+    client->local_file_pos = job->offset;
+    client->file_size = job->offset + job->size;
+    return true;
+}
+
+/**
+ * @brief Completes a GET request for a client.
+ * Only to be used after `parse_verb` and `read_file_name` have succeeded on this client.
+ * `client->header` contains the requested file name and `client->buffer_position` is the length of the string.
+ * @param client client that has a GET request
+ */
+void get(client_info* client) {
+    //check the dictionary for the file name, if it exists, then get the server info from the dictionary
+    //send that server info the client
+    //change the client state to stateDone
+
+    if (client->local_file == 0 && client->cached == NULL && client->disk_job == NULL) {
+        /* Check if the file exists */
+        // First: check if main server has it, or a copy of a sub-server's file that is asked for often
+        get_open job = {.compressing = client->compressing, .fd = -1};
+        if (!catalog_has_local(client->header)) {
+            job.fd = pullcache_open(client->header, &job.size);
+            if (job.fd == -1) {
+                redirect_get(client);
+                return;
+            }
+        }
+        client->cached = hotcache_get(client->header);
+        if (client->cached != NULL && client->compressing && hotcache_compressible(client->cached)) {
+            /* Worth compressing, which is done from the file */
+            hotcache_release(client->cached);
+            client->cached = NULL;
+        }
+        if (client->cached != NULL) {
+            if (job.fd != -1) {
+                close(job.fd);
+            }
+        } else {
+            /* Opening and looking into the file may wait for the disk, which other clients should not */
+            strcpy(job.name, client->header);
+            client->disk_job = diskpool_submit(open_for_get, &job, sizeof(job), discard_open_for_get, client->sock);
+        }
+    }
+    if (client->disk_job != NULL) {
+        if (!diskpool_done(client->disk_job)) {
+            wait_for_disk(client);
+            return;
+        }
+        const bool started = start_get(client, diskpool_data(client->disk_job));
+        diskpool_release(client->disk_job);
+        client->disk_job = NULL;
+        if (!started) {
+            return;
+        }
+    }
+
+    if (client->cached != NULL) {
+        if (send_cached(client)) {
+            client->state = DONE;
+        }
+        return;
+    }
+    if (client->codec != NULL) {
+        if (send_through_codec(client)) {
+            client->state = DONE;
+        }
+        return;
+    }
+    /* Sent straight from the page cache, continuing on the next call when the socket is full or the turn is over */
+    size_t budget = turn_budget(client);
+    while (client->local_file_pos < (ssize_t)client->file_size) {
+        if (budget == 0) {
+            return;
+        }
+        off_t pos = client->local_file_pos;
+        const ssize_t sent = sendfile(client->sock, client->local_file, &pos,
+                                      at_most(client->file_size - client->local_file_pos, budget));
+        if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (sent <= 0) {
+            break; /* The client is gone or the file shrank, nothing more we can do */
+        }
+        client->local_file_pos = pos;
+        budget -= sent;
+        moved(client, sent);
+    }
 
     client->state = DONE;
 }
 
+/**
+ * @brief Opens the file a PUT that is not packed is written to. While files may share their inode with a
+ * deduplicated object, that is a new file moved into place by finish_loose_file, otherwise the file itself.
+ * Runs on the disk pool.
+ */
+static int open_loose_file(const char* name, const unsigned long id) {
+    char buffer[LAYOUT_PATH_MAX];
+    const char* path = buffer;
+    if (!dedup_has_objects()) {
+        path = layout_path(name, buffer);
+    } else {
+        dedup_incoming_path(id, buffer);
+    }
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
+    if (fd != -1) {
+        compress_unmark_stored(fd); /* Truncating keeps the attributes of the old contents */
+    }
+    if (!dedup_has_objects()) {
+        /* Truncated in place, so GETs must not go on announcing the size or contents the caches still hold */
+        hotcache_invalidate(name);
+        fdcache_invalidate(name);
+    }
+    return fd;
+}
+
+/**
+ * @brief Opening the file of a PUT on the disk pool, which may take a while when it truncates a large file.
+ */
+typedef struct {
+    char name[1024];
+    unsigned long id; // upload_id of the client, tells concurrent uploads apart
+    bool compressed; // In: the ZPUT is to be stored compressed. Out: false if the file cannot be marked as such
+    size_t raw_size; // Uncompressed size of the contents
+    int fd; // Out: the file, -1 if it could not be opened
+    int error; // Out: errno if it could not
+} put_open;
+
+static void open_for_put(void* data) {
+    put_open* job = data;
+    job->fd = open_loose_file(job->name, job->id);
+    job->error = errno;
+    if (job->fd != -1 && job->compressed && !compress_mark_stored(job->fd, job->raw_size)) {
+        LOG("put: cannot mark %s as compressed (%s), storing it decompressed", job->name, strerror(errno));
+        job->compressed = false;
+    }
+}
+
+static void discard_open_for_put(void* data) {
+    const put_open* job = data;
+    if (job->fd != -1) {
+        close(job->fd);
+        if (dedup_has_objects()) {
+            char path[64];
+            dedup_incoming_path(job->id, path);
+            unlink(path); /* Nobody is going to write or commit it anymore */
+        }
+    }
+}
+
+/**
+ * @brief Appends `size` bytes to the file of a PUT, leaving the write to io_uring if it is in use.
+ */
+static void append_to_file(client_info* client, const void* data, const size_t size) {
+    if ((client->disk_writes == NULL || !uring_write(client->disk_writes, data, size, client->file_written)) &&
+        pwrite(client->local_file, data, size, client->file_written) != (ssize_t)size) {
+        client->write_failed = true;
+    }
+    client->file_written += size;
+}
+
+static void write_loose_file(client_info* client, const void* data, const size_t size) {
+    append_to_file(client, data, size);
+    if (client->digest != NULL) {
+        sha256_update(client->digest, data, size);
+    }
+}
+
+/**
+ * @return false if the upload could not be moved into place, in which case it is gone
+ */
+static bool finish_loose_file(const char* name, const unsigned long id, sha256_ctx* hash) {
+    if (!dedup_has_objects()) {
+        return true;
+    }
+    char path[LAYOUT_PATH_MAX];
+    unsigned char digest[SHA256_SIZE];
+    if (hash != NULL) {
+        sha256_final(hash, digest);
+    }
+    return dedup_commit(id, hash != NULL ? digest : NULL, layout_path(name, path));
+}
+
+/**
+ * @brief Putting a PUT whose contents all arrived in its place on the disk pool. Owns the contents and hash.
+ */
+typedef struct {
+    char name[1024];
+    unsigned long id; // upload_id of the client, tells concurrent uploads apart
+    char* small_file; // Contents that go into a pack, NULL if they were written to a loose file
+    size_t size;
+    sha256_ctx* digest;
+    bool stored; // Out: the file is in place, so the PUT can be acknowledged
+} put_commit;
+
+static void commit_put(void* data) {
+    put_commit* job = data;
+    char path[LAYOUT_PATH_MAX];
+    /* Only one of the two places may hold the file, the one written last replaces the other */
+    if (job->small_file != NULL && pack_put(job->name, job->small_file, job->size)) {
+        unlink(layout_path(job->name, path));
+        job->stored = true;
+        return;
+    }
+    if (job->small_file != NULL) {
+        /* The pack could not be written, store the file on its own instead */
+        const int fd = open_loose_file(job->name, job->id);
+        if (fd == -1) {
+            return;
+        }
+        const bool written = write(fd, job->small_file, job->size) == (ssize_t)job->size;
+        close(fd);
+        if (!written) {
+            return;
+        }
+        if (dedup_has_objects() && dedup_enabled()) {
+            job->digest = malloc(sizeof(sha256_ctx));
+            sha256_init(job->digest);
+            sha256_update(job->digest, job->small_file, job->size);
+        }
+    }
+    /* An older packed version that cannot be deleted would be served instead */
+    job->stored = finish_loose_file(job->name, job->id, job->digest) && pack_remove(job->name) != -1;
+}
+
+static void free_put_commit(void* data) {
+    const put_commit* job = data;
+    free(job->small_file);
+    free(job->digest);
+}
+
+/**
+ * @brief Stores `size` more bytes of the decompressed contents of a ZPUT.
+ */
+static void store_decompressed(void* ctx, const void* data, const size_t size) {
+    client_info* client = ctx;
+    if (client->local_file_pos + size > client->file_size) {
+        client->local_file_pos += size; /* More than announced, put() fails the upload */
+        return;
+    }
+    if (client->small_file != NULL) {
+        memcpy(client->small_file + client->local_file_pos, data, size);
+    } else if (client->stored_compressed) {
+        if (client->digest != NULL) {
+            sha256_update(client->digest, data, size); /* The file gets the compressed stream itself */
+        }
+    } else {
+        write_loose_file(client, data, size);
+    }
+    client->local_file_pos += size;
+}
+
+/**
+ * @brief Reads the zlib stream of a ZPUT from the client up to its end.
+ * @return true once all of it arrived, false to be called again later or if the upload failed (see state)
+ */
+static bool receive_compressed(client_info* client) {
+    char buffer[16 * 1024];
+    int result;
+    size_t budget = turn_budget(client);
+    do {
+        if (client->disk_writes != NULL && uring_busy(client->disk_writes)) {
+            wait_for_disk(client); /* Let the disk catch up first */
+            return false;
+        }
+        if (budget == 0) {
+            return false; /* Let the other clients have their turn */
+        }
+        const ssize_t read_result = read(client->sock, buffer, at_most(sizeof(buffer), budget));
+        if (read_result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return false;
+        }
+        if (read_result <= 0) {
+            client->state = INCORRECT_DATA_AMOUNT;
+            return false;
+        }
+        budget -= read_result;
+        moved(client, read_result);
+        if (client->stored_compressed) {
+            append_to_file(client, buffer, read_result);
+        }
+        result = compress_stream_write(client->codec, buffer, read_result, store_decompressed, client);
+    } while (result == 0);
+    if (result == -1 || client->local_file_pos != (ssize_t)client->file_size) {
+        client->state = INCORRECT_DATA_AMOUNT;
+        return false;
+    }
+    return true;
+}
+
 void put(client_info* client) {
     //if turn index is not 0, then redirect to the next server at that index
     //send the ip and port of the server to the client
@@ -548,15 +1660,16 @@ void put(client_info* client) {
     //increment the index, make sure it wraps around
     //exit the funciton
     //if the index is 0, then we do this
-    size_t n = vector_size(mini_servers);
+    const size_t n = catalog_server_count();
     if (client->local_file == 0) {
-        if (current_server_index != 0 && n > 0) {
+        server_info target;
+        if (current_server_index != 0 && n > 0 && catalog_get_server(current_server_index - 1, &target)) {
             // Redirect to the correct mini server
-            server_info* target = vector_get(mini_servers, current_server_index - 1);
-            dictionary_set(file_to_server, client->header, target);
+            catalog_set_remote(client->header, &target);
+            pullcache_invalidate(client->header);
 
             char msg[64];
-            snprintf(msg, sizeof(msg), "%s\n%s\n", target->ip, target->port);
+            snprintf(msg, sizeof(msg), "%s\n%s\n", target.ip, target.port);
             write_n_to_client(client, msg, strlen(msg));
 
             client->state = DONE;
@@ -570,21 +1683,27 @@ void put(client_info* client) {
     }
 
     if (client->local_file == 0) {
-        bool file_found = false;
-        VECTOR_FOR_EACH(
-            files, f,
-            if (strcmp(f, client->header) == 0) {
-            file_found = true;
-            break;
-            }
-        );
-        if (!file_found) {
-            vector_push_back(files, client->header);
-        }
-        client->local_file = open(client->header, O_WRONLY | O_CREAT | O_TRUNC, S_IRWXU);
-        memset(client->header, 0, client->buffer_position);
+        client->replacing = catalog_has_local(client->header);
+        catalog_add_local(client->header);
+        // Keeps the rebalancer from moving the file away while we are still writing it
+        catalog_begin_write(client->header);
+        client->local_file = -1; // Opened once we know whether it goes into a pack
         client->buffer_position = 0;
     }
+    if (client->compressing && client->encoding == 0) {
+        const ssize_t read_result = read(client->sock, &client->encoding, 1);
+        if (read_result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (read_result != 1) {
+            client->state = INCORRECT_DATA_AMOUNT;
+            return;
+        }
+        if (client->encoding != COMPRESS_RAW && client->encoding != COMPRESS_ZLIB) {
+            client->state = INVALID_VERB;
+            return;
+        }
+    }
     if (client->size_read == false) {
         read_n_from_client(client, &client->file_size, sizeof(client->file_size));
         if ((size_t)client->buffer_position < sizeof(client->file_size)) {
@@ -593,45 +1712,235 @@ void put(client_info* client) {
             client->size_read = true;
             client->buffer_position = 0;
         }
+        if (client->encoding == COMPRESS_ZLIB) {
+            client->codec = compress_stream_create(false, 0);
+        }
+        if (pack_wants(client->file_size)) {
+            client->small_file = malloc(client->file_size + 1);
+        } else {
+            put_open job = {.id = client->upload_id, .raw_size = client->file_size, .fd = -1};
+            strcpy(job.name, client->header);
+            job.compressed = client->encoding == COMPRESS_ZLIB && store_compressed;
+            client->disk_job = diskpool_submit(open_for_put, &job, sizeof(job), discard_open_for_put, client->sock);
+        }
+    }
+    if (client->disk_job != NULL && !client->received) {
+        if (!diskpool_done(client->disk_job)) {
+            wait_for_disk(client);
+            return;
+        }
+        const put_open* opened = diskpool_data(client->disk_job);
+        client->local_file = opened->fd;
+        client->stored_compressed = opened->compressed;
+        if (client->local_file == -1) {
+            LOG("put: opening %s failed: %s", client->header, strerror(opened->error));
+        }
+        diskpool_release(client->disk_job);
+        client->disk_job = NULL;
+        if (client->local_file == -1) {
+            client->state = INVALID_FILE;
+            return;
+        }
+        if (dedup_has_objects() && dedup_enabled()) {
+            client->digest = malloc(sizeof(sha256_ctx));
+            sha256_init(client->digest);
+        }
+        client->disk_writes = uring_file_create(client->local_file, client->sock);
     }
 
-
-    do {
-        const ssize_t read_result = read(client->sock, client->header, 1024);
-        if (read_result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    char buffer[PUT_BUFFER_SIZE];
+    if (client->received) {
+        /* Only waiting for the disk */
+    } else if (client->codec != NULL) {
+        if (!receive_compressed(client)) {
             return;
         }
-        if (read_result == 0 && client->local_file_pos < (ssize_t)client->file_size) {
-            client->state = INCORRECT_DATA_AMOUNT;
+    } else {
+        size_t budget = turn_budget(client);
+        while (client->local_file_pos < (ssize_t)client->file_size) {
+            if (client->disk_writes != NULL && uring_busy(client->disk_writes)) {
+                wait_for_disk(client); /* Let the disk catch up first */
+                return;
+            }
+            if (budget == 0) {
+                return; /* Let the other clients have their turn */
+            }
+            const size_t left = at_most(client->file_size - client->local_file_pos, budget);
+            ssize_t read_result;
+            if (client->small_file != NULL) {
+                read_result = read(client->sock, client->small_file + client->local_file_pos, left);
+            } else {
+                read_result = read(client->sock, buffer, at_most(left, sizeof(buffer)));
+            }
+            if (read_result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (read_result <= 0) {
+                client->state = INCORRECT_DATA_AMOUNT;
+                return;
+            }
+            if (client->small_file == NULL) {
+                write_loose_file(client, buffer, read_result);
+            }
+            client->local_file_pos += read_result;
+            budget -= read_result;
+            moved(client, read_result);
+        }
+    }
+    client->received = true;
+    if (client->disk_writes != NULL) {
+        if (!uring_done(client->disk_writes)) {
+            /* Finished once the file is on disk, so moving it into place cannot race the writes */
+            wait_for_disk(client);
             return;
         }
-        write(client->local_file, client->header, read_result);
-        client->local_file_pos += read_result;
-    } while (client->local_file_pos < (ssize_t)client->file_size);
+        if (uring_failed(client->disk_writes)) {
+            client->write_failed = true;
+        }
+    }
+    if (client->write_failed) {
+        LOG("put: writing %s failed", client->header);
+        client->state = INCORRECT_DATA_AMOUNT;
+        return;
+    }
+    if (client->disk_job == NULL) {
+        put_commit job = {.id = client->upload_id, .small_file = client->small_file, .size = client->file_size,
+                          .digest = client->digest};
+        strcpy(job.name, client->header);
+        client->small_file = NULL;
+        client->digest = NULL;
+        client->disk_job = diskpool_submit(commit_put, &job, sizeof(job), free_put_commit, client->sock);
+    }
+    if (!diskpool_done(client->disk_job)) {
+        wait_for_disk(client);
+        return;
+    }
+    put_commit* committed = diskpool_data(client->disk_job);
+    const bool stored = committed->stored;
+    free_put_commit(committed);
+    diskpool_release(client->disk_job);
+    client->disk_job = NULL;
+    hotcache_invalidate(client->header);
+    fdcache_invalidate(client->header);
+    if (!stored) {
+        LOG("put: storing %s failed", client->header);
+        client->state = INCORRECT_DATA_AMOUNT;
+        return;
+    }
+    send_ok_msg_to_client(client);
+    catalog_sync_record(client->replacing ? SYNC_UPDATE : SYNC_ADD, client->header);
     client->state = DONE;
 }
 
+/**
+ * @brief Deleting the file of a DELETE on the disk pool.
+ */
+typedef struct {
+    char name[1024];
+    bool deleted; // Out: false if the file could not be deleted, it is still there then
+} delete_job;
+
+static void delete_file(void* data) {
+    delete_job* job = data;
+    char path[LAYOUT_PATH_MAX];
+    const int packed = pack_remove(job->name);
+    job->deleted = packed == 1 || (packed == 0 && (unlink(layout_path(job->name, path)) == 0 || errno == ENOENT));
+    if (job->deleted) {
+        catalog_remove_local(job->name);
+    }
+}
+
 void delete(client_info* client) {
     // Same beginning as get, instead of sending delete
-    /* Check if the file exists */
-    bool file_found = false;
-    size_t pos = 0;
-    VECTOR_FOR_EACH(
-        files, f,
-        if (strcmp(f, client->header) == 0) {
-        file_found = true;
-        break;
+    if (client->disk_job == NULL) {
+        /* Check if the file exists */
+        if (!catalog_has_local(client->header)) {
+            client->state = INVALID_FILE;
+            return;
         }
-        ++pos;
-    );
-    if (!file_found) {
+        /* The only difference with GET is deleting */
+        delete_job job = {.deleted = false};
+        strcpy(job.name, client->header);
+        client->disk_job = diskpool_submit(delete_file, &job, sizeof(job), NULL, client->sock);
+    }
+    if (!diskpool_done(client->disk_job)) {
+        wait_for_disk(client);
+        return;
+    }
+    const bool deleted = ((delete_job*)diskpool_data(client->disk_job))->deleted;
+    diskpool_release(client->disk_job);
+    client->disk_job = NULL;
+    if (!deleted) {
+        LOG("delete: deleting %s failed", client->header);
+        client->state = INVALID_FILE;
+        return;
+    }
+    send_ok_msg_to_client(client);
+    hotcache_invalidate(client->header);
+    fdcache_invalidate(client->header);
+    catalog_sync_record(SYNC_REMOVE, client->header);
+    client->state = DONE;
+}
+
+/**
+ * @brief Linking the name of a LINK to the contents it names on the disk pool.
+ */
+typedef struct {
+    char name[1024];
+    unsigned long id; // upload_id of the client, tells concurrent links apart
+    unsigned char digest[SHA256_SIZE];
+    bool replacing; // Out: we already had a file of that name
+    bool linked; // Out: the name now has those contents, false if we do not have them or linking failed
+} link_job;
+
+static void link_to_contents(void* data) {
+    link_job* job = data;
+    char path[LAYOUT_PATH_MAX];
+    /* Under the catalog lock, so the rebalancer cannot move the file away in between */
+    catalog_lock();
+    job->replacing = catalog_has_local(job->name);
+    /* An older packed version that cannot be deleted would be served instead */
+    job->linked = dedup_link(job->id, job->digest, layout_path(job->name, path)) && pack_remove(job->name) != -1;
+    if (job->linked) {
+        catalog_add_local(job->name);
+    }
+    catalog_unlock();
+}
+
+/**
+ * @brief Stores `<name>` as another link to the contents with the SHA-256 `<hex>`, sent as `LINK <name> <hex>\n`.
+ * Answers like a failed GET if we do not have those contents, the client then uploads the file with PUT.
+ * @param client client that sent LINK
+ */
+void link_file(client_info* client) {
+    if (client->disk_job == NULL) {
+        link_job job = {.id = client->upload_id};
+        char* hex = strrchr(client->header, ' ');
+        if (hex == NULL || !sha256_from_hex(hex + 1, job.digest)) {
+            client->state = INVALID_VERB;
+            return;
+        }
+        *hex = '\0';
+        strcpy(job.name, client->header);
+        client->disk_job = diskpool_submit(link_to_contents, &job, sizeof(job), NULL, client->sock);
+    }
+    if (!diskpool_done(client->disk_job)) {
+        wait_for_disk(client);
+        return;
+    }
+    const link_job* done = diskpool_data(client->disk_job);
+    const bool linked = done->linked;
+    const bool replacing = done->replacing;
+    diskpool_release(client->disk_job);
+    client->disk_job = NULL;
+    if (!linked) {
         client->state = INVALID_FILE;
         return;
     }
+    hotcache_invalidate(client->header);
+    fdcache_invalidate(client->header);
     send_ok_msg_to_client(client);
-    /* The only difference with GET is deleting */
-    unlink(client->header);
-    vector_erase(files, pos);
+    catalog_sync_record(replacing ? SYNC_UPDATE : SYNC_ADD, client->header);
     client->state = DONE;
 }
 
@@ -639,8 +1948,9 @@ void list(client_info* client) {
     size_t buffer_size = 128;
     char* file_list = malloc(buffer_size);
     size_t total_bytes = 0;
+    vector* local = catalog_local_files();
     VECTOR_FOR_EACH(
-        files, file,
+        local, file,
         const size_t len = strlen(file);
         if (total_bytes + len + 1 >= buffer_size) {
         buffer_size *= 2;
@@ -650,9 +1960,10 @@ void list(client_info* client) {
         total_bytes += len;
         file_list[total_bytes++] = '\n';
     );
+    vector_destroy(local);
     // Also send all the files on other servers
-    if (dictionary_size(file_to_server) > 0) {
-        vector* v = dictionary_keys(file_to_server);
+    vector* v = catalog_remote_files();
+    if (vector_size(v) > 0) {
         for (size_t i = 0; i < vector_size(v); ++i) {
             char* file = vector_get(v, i);
             const size_t len = strlen(file);
@@ -666,9 +1977,10 @@ void list(client_info* client) {
         }
         --total_bytes;
     }
+    vector_destroy(v);
 
-    send_ok_msg_to_client(client);
-    if (write_n_to_client(client, &total_bytes, sizeof(total_bytes)) != sizeof(total_bytes)) {
+    struct iovec header[] = {{"OK\n", 3}, {&total_bytes, sizeof(total_bytes)}};
+    if (!write_parts_to_client(client, header, 2, total_bytes > 0)) {
         client->state = INCORRECT_DATA_AMOUNT;
         return;
     }
@@ -680,35 +1992,189 @@ void list(client_info* client) {
     client->state = DONE;
 }
 
-void add_server(client_info* client) {
-    // client->header is <ip> <port>
-    char* p = strchr(client->header, ' ');
-    *p = '\0';
-    server_info s;
-    strcpy(s.ip, client->header);
-    strcpy(s.port, p + 1);
+/**
+ * @brief Completes a LIST_ALL request: asks every sub-server for its listing instead of trusting `file_to_server`.
+ * Called again on every event loop iteration until all sub-servers answered or the deadline passed.
+ * The response is `OK\n<answered>/<queried>\n<size><names>`, so the client can tell when some sub-servers are missing.
+ * @param client client that has a LIST_ALL request
+ */
+void list_all(client_info* client) {
+    if (client->fanout == NULL) {
+        client->fanout = fanout_start(epoll_fd, list_deadline);
+    }
+    if (!fanout_done(client->fanout)) {
+        return;
+    }
+    size_t answered, queried;
+    vector* remote = fanout_results(client->fanout, &answered, &queried);
+    fanout_destroy(client->fanout);
+    client->fanout = NULL;
 
+    size_t buffer_size = 128;
+    char* file_list = malloc(buffer_size);
+    size_t total_bytes = 0;
+    vector* local = catalog_local_files();
+    for (int pass = 0; pass < 2; ++pass) {
+        vector* names = pass == 0 ? local : remote;
+        VECTOR_FOR_EACH(
+            names, file,
+            const size_t len = strlen(file);
+            while (total_bytes + len + 1 >= buffer_size) {
+            buffer_size *= 2;
+            file_list = realloc(file_list, buffer_size);
+            }
+            memcpy(file_list + total_bytes, file, len);
+            total_bytes += len;
+            file_list[total_bytes++] = '\n';
+        );
+    }
+    vector_destroy(local);
+    vector_destroy(remote);
+    if (total_bytes > 0) {
+        --total_bytes;
+    }
 
-    size_t bytes_read = 0;
-    size_t size;
+    char status[64];
+    const int status_len = snprintf(status, sizeof(status), "%zu/%zu\n", answered, queried);
+    struct iovec header[] = {{"OK\n", 3}, {status, status_len}, {&total_bytes, sizeof(total_bytes)}};
+    if (!write_parts_to_client(client, header, 3, total_bytes > 0) ||
+        write_n_to_client(client, file_list, (ssize_t)total_bytes) != (ssize_t)total_bytes) {
+        free(file_list);
+        client->state = INCORRECT_DATA_AMOUNT;
+        return;
+    }
+    free(file_list);
+    client->state = DONE;
+}
 
-    read(client->sock, &size, sizeof(size));
-    // while (bytes_read < sizeof(size_t)) {
-    //     const ssize_t cur_read = read(client->sock, &size + bytes_read, sizeof(size_t) - bytes_read);
-    //     if (cur_read == -1 || cur_read == 0) {
-    //         break;
-    //     }
-    //     bytes_read += cur_read;
-    // }
-
-    char buffer[1024] = {0};
-    bytes_read = 0;
-    while (bytes_read < size) {
-        bytes_read += read_line_from_client(client, buffer, 1024);
-        dictionary_set(file_to_server, buffer, &s);
-    }
-    vector_push_back(mini_servers, &s);
+/**
+ * @brief Handles the SYNC connection of a sub-server, which stays open for as long as the sub-server runs.
+ * The first call registers the sub-server and tells it how far our catalog is current, after that every call applies
+ * whatever catalog changes arrived since.
+ * `client->header` contains `<ip> <port> <epoch>`.
+ * @param client client that sent SYNC
+ */
+void sync_catalog(client_info* client) {
+    if (client->sync == NULL) {
+        server_info s;
+        unsigned long long epoch;
+        char ip[64], port[16];
+        if (sscanf(client->header, "%63s %15s %llu", ip, port, &epoch) != 3 || strlen(ip) >= sizeof(s.ip) ||
+            strlen(port) >= sizeof(s.port)) {
+            client->state = INVALID_VERB;
+            return;
+        }
+        strcpy(s.ip, ip);
+        strcpy(s.port, port);
+        client->sync = sync_session_create(&s, epoch);
+        if (catalog_add_server(&s)) {
+            rebalance_server_added(&s);
+        }
+        const uint64_t acked = sync_session_acked(client->sync);
+        struct iovec header[] = {{"OK\n", 3}, {(void*)&acked, sizeof(acked)}};
+        write_parts_to_client(client, header, 2, false);
+        LOG("sync: sub-server %s:%s connected, catalog current to event %llu", s.ip, s.port,
+            (unsigned long long)acked);
+    }
+
+    char buffer[4096];
+    ssize_t read_result;
+    while ((read_result = read(client->sock, buffer, sizeof(buffer))) > 0) {
+        moved(client, read_result);
+        if (!sync_session_feed(client->sync, buffer, read_result)) {
+            LOG("sync: malformed update from sub-server, dropping the connection");
+            client->state = DONE;
+            return;
+        }
+    }
+    if (read_result == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        client->state = DONE; /* The sub-server went away, it reconnects and catches up on its own */
+    }
+}
+
+/**
+ * @brief Completes an ADD_SERVER request: `<size>` followed by `size` bytes of newline separated file names.
+ * Called again on every event loop iteration until the whole listing arrived, reading at most
+ * ADD_SERVER_READ_BUDGET bytes each time, so registering a large or slow sub-server never stalls other clients.
+ * The names are collected until the listing is complete and then added to the catalog as one batch, so a
+ * sub-server that goes away halfway does not leave names pointing to a server we never registered.
+ * `client->header` contains `<ip> <port>` at first, then holds the file name currently being read.
+ * @param client client that has an ADD_SERVER request
+ */
+void add_server(client_info* client) {
+    if (client->registering.ip[0] == '\0') {
+        char ip[64], port[16];
+        if (sscanf(client->header, "%63s %15s", ip, port) != 2 || strlen(ip) >= sizeof(client->registering.ip) ||
+            strlen(port) >= sizeof(client->registering.port)) {
+            client->state = INVALID_VERB;
+            return;
+        }
+        strcpy(client->registering.ip, ip);
+        strcpy(client->registering.port, port);
+        client->announced = string_vector_create();
+        client->buffer_position = 0;
+    }
+    if (client->size_read == false) {
+        const ssize_t res = read_n_from_client(client, &client->file_size, sizeof(client->file_size));
+        if (res < 0) {
+            client->state = INCORRECT_DATA_AMOUNT;
+            return;
+        }
+        if ((size_t)client->buffer_position < sizeof(client->file_size)) {
+            return;
+        }
+        client->size_read = true;
+        client->buffer_position = 0;
+    }
+
+    char buffer[4096];
+    size_t budget = ADD_SERVER_READ_BUDGET;
+    bool eof = false;
+    while (budget > 0 && client->local_file_pos < (ssize_t)client->file_size) {
+        size_t want = client->file_size - client->local_file_pos;
+        want = want < sizeof(buffer) ? want : sizeof(buffer);
+        const ssize_t read_result = read(client->sock, buffer, want);
+        if (read_result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (read_result <= 0) {
+            eof = true;
+            break;
+        }
+        for (ssize_t i = 0; i < read_result; ++i) {
+            if (buffer[i] == '\n') {
+                client->header[client->buffer_position] = '\0';
+                vector_push_back(client->announced, client->header);
+                client->buffer_position = 0;
+            } else if (client->buffer_position < (ssize_t)sizeof(client->header) - 1) {
+                client->header[client->buffer_position++] = buffer[i];
+            } else {
+                LOG("add_server: %s:%s announced a file name that is too long", client->registering.ip,
+                    client->registering.port);
+                client->state = INCORRECT_DATA_AMOUNT;
+                return;
+            }
+        }
+        client->local_file_pos += read_result;
+        moved(client, read_result);
+        budget -= read_result;
+    }
+    const bool complete = client->local_file_pos == (ssize_t)client->file_size;
+    if (complete && client->buffer_position > 0) { /* The last name has no trailing newline */
+        client->header[client->buffer_position] = '\0';
+        vector_push_back(client->announced, client->header);
+        client->buffer_position = 0;
+    }
+    if (!complete) {
+        if (eof) {
+            client->state = INCORRECT_DATA_AMOUNT;
+        }
+        return;
+    }
+    catalog_set_remote_many(client->announced, &client->registering);
+    catalog_add_server(&client->registering);
     send_ok_msg_to_client(client); // Notify the client that the operation was successful
+    rebalance_server_added(&client->registering);
     client->state = DONE;
 }
 
@@ -732,7 +2198,50 @@ void send_incorrect_data_msg_to_client(const client_info* client) {
     write_n_to_client(client, err_bad_file_size, 14);
 }
 
+void send_busy_msg_to_client(const client_info* client) {
+    char msg[64];
+    const int len = snprintf(msg, sizeof(msg), err_busy, retry_after);
+    write_n_to_client(client, msg, len);
+}
+
 void close_client_connection(const client_info* client) {
+    open_connections -= client->connected;
+    if (client->admitted) {
+        --active_requests;
+        active_gets -= client->action == GET;
+        active_puts -= client->action == PUT;
+    }
+    if (client->action == PUT && client->local_file != 0) {
+        catalog_end_write(client->header);
+    }
+    release_local_file(client);
+    if (client->action == PUT && client->state != DONE && client->local_file > 0 && dedup_has_objects() &&
+        client->disk_job == NULL) { /* Otherwise the disk pool is moving it into place */
+        char path[64];
+        dedup_incoming_path(client->upload_id, path);
+        unlink(path); /* An upload that did not finish */
+    }
+    diskpool_abandon(client->disk_job);
+    timerwheel_timer_destroy(client->deadline);
+    timerwheel_timer_destroy(client->resume);
+    ratelimit_disconnect(client->limit);
+    uring_file_release(client->disk_writes);
+    free(client->small_file);
+    free(client->digest);
+    compress_stream_destroy(client->codec);
+    free(client->pending);
+    if (client->cached != NULL) {
+        hotcache_release(client->cached);
+    }
+    if (client->fanout != NULL) {
+        fanout_destroy(client->fanout);
+    }
+    if (client->announced != NULL) {
+        vector_destroy(client->announced);
+    }
+    if (client->sync != NULL) {
+        sync_session_destroy(client->sync);
+    }
     shutdown(client->sock, SHUT_RDWR);
 }
 
@@ -0,0 +1,49 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * SHA-256 (FIPS 180-4), used to identify file contents.
+ */
+#define SHA256_SIZE 32 // Bytes in a digest
+#define SHA256_HEX_SIZE 65 // Bytes of a digest in hex, including the terminating '\0'
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t length; // Bytes hashed so far
+    unsigned char block[64];
+    size_t used; // Bytes of `block` filled
+} sha256_ctx;
+
+void sha256_init(sha256_ctx* ctx);
+
+void sha256_update(sha256_ctx* ctx, const void* data, size_t size);
+
+/**
+ * @brief Writes the digest of everything passed to sha256_update to `digest`. `ctx` has to be initialized again
+ * before it is reused.
+ */
+void sha256_final(sha256_ctx* ctx, unsigned char digest[SHA256_SIZE]);
+
+/**
+ * @brief Hashes `size` bytes of `fd` starting at `offset`.
+ * @return false if they could not all be read
+ */
+bool sha256_fd(int fd, off_t offset, size_t size, unsigned char digest[SHA256_SIZE]);
+
+/**
+ * @brief Writes `digest` as lowercase hex to `hex`.
+ */
+void sha256_to_hex(const unsigned char digest[SHA256_SIZE], char hex[SHA256_HEX_SIZE]);
+
+/**
+ * @brief Parses a digest written by sha256_to_hex.
+ * @return false if `hex` is not 64 hex digits
+ */
+bool sha256_from_hex(const char* hex, unsigned char digest[SHA256_SIZE]);
@@ -0,0 +1,336 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "catalog.h"
+#include "common.h"
+#include "scan.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "PISHCAT1"
+
+typedef struct {
+    char magic[8];
+    uint32_t server_count;
+    uint32_t checksum;
+    uint64_t local_count;
+    uint64_t remote_count;
+    uint64_t payload_size;
+} snapshot_header;
+
+typedef struct {
+    char* name;
+    uint32_t server;
+} remote_entry;
+
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool saved = false; // Whether saved_version is meaningful
+static unsigned long saved_version; // catalog_version() of the last snapshot we wrote or loaded
+
+static char* snapshot_path;
+static char* reconcile_dir;
+static unsigned snapshot_interval;
+static size_t reconcile_threads;
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+/**
+ * @brief Updates a CRC-32 (the one used by zlib and PNG) with `len` more bytes. Start with a crc of 0.
+ */
+static uint32_t crc32_update(uint32_t crc, const void* data, size_t len) {
+    pthread_once(&crc_once, crc_init);
+    const unsigned char* bytes = data;
+    crc = ~crc;
+    while (len--) {
+        crc = crc_table[(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Returns the length of the string at `*pos`, and moves `*pos` past it, or -1 if it is not terminated before
+ * `end`.
+ */
+static ssize_t next_string(const char** pos, const char* end) {
+    const char* nul = memchr(*pos, '\0', end - *pos);
+    if (nul == NULL) {
+        return -1;
+    }
+    const ssize_t len = nul - *pos;
+    *pos = nul + 1;
+    return len;
+}
+
+/**
+ * @brief Checks the snapshot in `data` and splits it into vectors pointing into it.
+ * @return false if anything about it is inconsistent
+ */
+static bool parse(const char* data, const size_t size, vector* servers, vector* locals, vector* remotes,
+                  vector* remote_servers) {
+    snapshot_header header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.payload_size != size - sizeof(header) ||
+        crc32_update(0, data + sizeof(header), header.payload_size) != header.checksum) {
+        return false;
+    }
+    const char* pos = data + sizeof(header);
+    const char* end = data + size;
+    for (uint32_t i = 0; i < header.server_count; ++i) {
+        server_info s;
+        const char* ip = pos;
+        const ssize_t ip_len = next_string(&pos, end);
+        const char* port = pos;
+        const ssize_t port_len = ip_len < 0 ? -1 : next_string(&pos, end);
+        if (port_len < 0 || (size_t)ip_len >= sizeof(s.ip) || (size_t)port_len >= sizeof(s.port)) {
+            return false;
+        }
+        strcpy(s.ip, ip);
+        strcpy(s.port, port);
+        vector_push_back(servers, &s);
+    }
+    for (uint64_t i = 0; i < header.local_count; ++i) {
+        const char* name = pos;
+        if (next_string(&pos, end) <= 0) {
+            return false;
+        }
+        vector_push_back(locals, (void*)name);
+    }
+    for (uint64_t i = 0; i < header.remote_count; ++i) {
+        uint32_t server;
+        if (end - pos < (ssize_t)sizeof(server)) {
+            return false;
+        }
+        memcpy(&server, pos, sizeof(server));
+        pos += sizeof(server);
+        const char* name = pos;
+        if (server >= header.server_count || next_string(&pos, end) <= 0) {
+            return false;
+        }
+        vector_push_back(remotes, (void*)name);
+        vector_push_back(remote_servers, &server);
+    }
+    return pos == end;
+}
+
+bool snapshot_load(const char* path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat s;
+    if (fstat(fd, &s) == -1 || s.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    const size_t size = s.st_size;
+    char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap() failed");
+        return false;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    vector* servers = vector_create(server_info_copy_constructor, free, server_info_default_constructor);
+    vector* locals = shallow_vector_create();
+    vector* remotes = shallow_vector_create();
+    vector* remote_servers = unsigned_int_vector_create();
+    const bool ok = parse(data, size, servers, locals, remotes, remote_servers);
+    if (ok) {
+        catalog_lock();
+        catalog_add_local_many(locals);
+        /* Group the remote files by sub-server, so every group is one batch */
+        vector* batch = shallow_vector_create();
+        for (size_t server = 0; server < vector_size(servers); ++server) {
+            vector_clear(batch);
+            for (size_t i = 0; i < vector_size(remotes); ++i) {
+                if (*(unsigned*)vector_get(remote_servers, i) == server) {
+                    vector_push_back(batch, vector_get(remotes, i));
+                }
+            }
+            catalog_set_remote_many(batch, vector_get(servers, server));
+            catalog_add_server(vector_get(servers, server));
+        }
+        vector_destroy(batch);
+        const unsigned long version = catalog_version();
+        catalog_unlock();
+        /* No need to write the same snapshot back */
+        pthread_mutex_lock(&save_lock);
+        saved = true;
+        saved_version = version;
+        pthread_mutex_unlock(&save_lock);
+        LOG("snapshot: restored %zu local files, %zu remote files and %zu sub-servers from %s",
+            vector_size(locals), vector_size(remotes), vector_size(servers), path);
+    } else {
+        LOG("snapshot: %s is damaged, ignoring it", path);
+    }
+    vector_destroy(servers);
+    vector_destroy(locals);
+    vector_destroy(remotes);
+    vector_destroy(remote_servers);
+    munmap(data, size);
+    return ok;
+}
+
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int compare_remote_entries(const void* a, const void* b) {
+    return strcmp(((const remote_entry*)a)->name, ((const remote_entry*)b)->name);
+}
+
+/**
+ * @brief Writes `len` bytes to `f` and adds them to `crc`.
+ */
+static bool write_payload(FILE* f, const void* data, const size_t len, uint32_t* crc) {
+    *crc = crc32_update(*crc, data, len);
+    return fwrite(data, 1, len, f) == len;
+}
+
+bool snapshot_save(const char* path) {
+    pthread_mutex_lock(&save_lock);
+    /* Copy everything while holding the catalog lock, so the snapshot is consistent */
+    catalog_lock();
+    const unsigned long version = catalog_version();
+    if (saved && version == saved_version) {
+        catalog_unlock();
+        pthread_mutex_unlock(&save_lock);
+        return true;
+    }
+    vector* servers = vector_create(server_info_copy_constructor, free, server_info_default_constructor);
+    server_info s;
+    for (size_t i = 0; catalog_get_server(i, &s); ++i) {
+        vector_push_back(servers, &s);
+    }
+    vector* locals = catalog_local_files();
+    vector* remote_names = catalog_remote_files();
+    remote_entry* remotes = malloc((vector_size(remote_names) + 1) * sizeof(remote_entry));
+    size_t remote_count = 0;
+    for (size_t i = 0; i < vector_size(remote_names); ++i) {
+        char* name = vector_get(remote_names, i);
+        if (!catalog_lookup_remote(name, &s)) {
+            continue;
+        }
+        for (size_t j = 0; j < vector_size(servers); ++j) {
+            if (server_info_equals(vector_get(servers, j), &s)) {
+                remotes[remote_count++] = (remote_entry){name, (uint32_t)j};
+                break;
+            }
+        }
+        /* Files announced by a sub-server that has not finished registering are left out */
+    }
+    catalog_unlock();
+
+    qsort(vector_begin(locals), vector_size(locals), sizeof(void*), compare_names);
+    qsort(remotes, remote_count, sizeof(remote_entry), compare_remote_entries);
+
+    char* tmp_path;
+    asprintf(&tmp_path, "%s.tmp", path);
+    FILE* f = fopen(tmp_path, "w");
+    bool ok = f != NULL;
+    snapshot_header header = {SNAPSHOT_MAGIC, (uint32_t)vector_size(servers), 0, vector_size(locals), remote_count,
+                              0};
+    if (ok) {
+        setvbuf(f, NULL, _IOFBF, 1 << 20);
+        ok = fwrite(&header, sizeof(header), 1, f) == 1; /* Rewritten once the checksum is known */
+    }
+    uint32_t crc = 0;
+    uint64_t payload_size = 0;
+    for (size_t i = 0; ok && i < vector_size(servers); ++i) {
+        const server_info* server = vector_get(servers, i);
+        const size_t ip_len = strlen(server->ip) + 1;
+        const size_t port_len = strlen(server->port) + 1;
+        ok = write_payload(f, server->ip, ip_len, &crc) && write_payload(f, server->port, port_len, &crc);
+        payload_size += ip_len + port_len;
+    }
+    for (size_t i = 0; ok && i < vector_size(locals); ++i) {
+        const char* name = vector_get(locals, i);
+        const size_t len = strlen(name) + 1;
+        ok = write_payload(f, name, len, &crc);
+        payload_size += len;
+    }
+    for (size_t i = 0; ok && i < remote_count; ++i) {
+        const size_t len = strlen(remotes[i].name) + 1;
+        ok = write_payload(f, &remotes[i].server, sizeof(remotes[i].server), &crc) &&
+             write_payload(f, remotes[i].name, len, &crc);
+        payload_size += sizeof(remotes[i].server) + len;
+    }
+    if (ok) {
+        header.checksum = crc;
+        header.payload_size = payload_size;
+        ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1 && fflush(f) == 0 &&
+             fsync(fileno(f)) == 0;
+    }
+    if (f != NULL && fclose(f) != 0) {
+        ok = false;
+    }
+    if (ok && rename(tmp_path, path) == -1) {
+        ok = false;
+    }
+    if (ok) {
+        saved = true;
+        saved_version = version;
+    } else {
+        perror("snapshot: writing the catalog failed");
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    free(remotes);
+    vector_destroy(remote_names);
+    vector_destroy(locals);
+    vector_destroy(servers);
+    pthread_mutex_unlock(&save_lock);
+    return ok;
+}
+
+static void* snapshot_worker(void* arg) {
+    (void)arg;
+    if (reconcile_dir != NULL) {
+        scan_reconcile(reconcile_dir, reconcile_threads);
+    }
+    while (snapshot_interval > 0) {
+        sleep(snapshot_interval);
+        snapshot_save(snapshot_path);
+    }
+    return NULL;
+}
+
+void snapshot_start(const char* path, const unsigned interval, const char* dir, const size_t scan_threads) {
+    if (interval == 0 && dir == NULL) {
+        return;
+    }
+    snapshot_path = strdup(path);
+    reconcile_dir = dir != NULL ? strdup(dir) : NULL;
+    snapshot_interval = interval;
+    reconcile_threads = scan_threads;
+
+    if (!spawn_detached(snapshot_worker, NULL)) {
+        exit(1);
+    }
+}
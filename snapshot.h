@@ -0,0 +1,42 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Default number of seconds between two snapshots of a catalog that changed
+#define SNAPSHOT_DEFAULT_INTERVAL 60
+
+/**
+ * The catalog is saved to disk so a restarted server can serve requests right away instead of walking Pi-Share,
+ * and remembers its sub-servers and the files they hold without them registering again.
+ *
+ * Layout of a snapshot file (integers in host byte order):
+ *   header:  "PISHCAT1" <server count:uint32> <crc32 of the payload:uint32>
+ *            <local file count:uint64> <remote file count:uint64> <payload size:uint64>
+ *   payload: <ip>\0<port>\0 per sub-server
+ *            <name>\0 per local file, sorted
+ *            <sub-server index:uint32><name>\0 per remote file, sorted by name
+ */
+
+/**
+ * @brief Fills the catalog from the snapshot at `path`.
+ * @return false, leaving the catalog untouched, if there is no snapshot or it is damaged
+ */
+bool snapshot_load(const char* path);
+
+/**
+ * @brief Writes the catalog to `path` if it changed since the last snapshot. The file is replaced atomically.
+ * @return false if the snapshot could not be written
+ */
+bool snapshot_save(const char* path);
+
+/**
+ * @brief Starts a background thread that saves the catalog to `path` every `interval` seconds (0 never does).
+ * @param reconcile_dir if not NULL, the thread first brings the catalog's local files in line with the contents of
+ * this directory, for catalogs restored by snapshot_load
+ * @param scan_threads threads used to stat files while reconciling, see scan_local_files
+ */
+void snapshot_start(const char* path, unsigned interval, const char* reconcile_dir, size_t scan_threads);
@@ -0,0 +1,146 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timerwheel.h"
+
+#define SLOT_MASK (TIMERWHEEL_SLOTS - 1)
+
+struct wheel_timer {
+    void (*expired)(int id, void* arg);
+    int id;
+    unsigned long long expires; // Tick it goes off at
+    wheel_timer** slot; // List it is in, NULL if it is not armed
+    wheel_timer* prev;
+    wheel_timer* next;
+};
+
+static wheel_timer* slots[TIMERWHEEL_LEVELS][TIMERWHEEL_SLOTS];
+static unsigned long long current; // Last tick whose timers went off
+static size_t armed;
+
+static unsigned long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Puts `timer` in the slot for its `expires`, which is after `current`.
+ */
+static void link_timer(wheel_timer* timer) {
+    const unsigned long long delta = timer->expires - current;
+    int level = 0;
+    while (level < TIMERWHEEL_LEVELS - 1 && delta >= 1ULL << (TIMERWHEEL_SLOT_BITS * (level + 1))) {
+        ++level;
+    }
+    unsigned long long at = timer->expires;
+    if (delta >= 1ULL << (TIMERWHEEL_SLOT_BITS * TIMERWHEEL_LEVELS)) {
+        /* Beyond what the wheel covers, wait in the farthest slot and get placed again from there */
+        at = current + ((unsigned long long)SLOT_MASK << (TIMERWHEEL_SLOT_BITS * level));
+    }
+    wheel_timer** slot = &slots[level][(at >> (TIMERWHEEL_SLOT_BITS * level)) & SLOT_MASK];
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->prev = timer;
+    }
+    *slot = timer;
+}
+
+static void unlink_timer(wheel_timer* timer) {
+    if (timer->prev != NULL) {
+        timer->prev->next = timer->next;
+    } else {
+        *timer->slot = timer->next;
+    }
+    if (timer->next != NULL) {
+        timer->next->prev = timer->prev;
+    }
+    timer->slot = NULL;
+}
+
+/**
+ * @brief Moves the timers of a slot on `level` that came around down to the levels below.
+ */
+static void cascade(const int level, const size_t index) {
+    wheel_timer* timer = slots[level][index];
+    slots[level][index] = NULL;
+    while (timer != NULL) {
+        wheel_timer* next = timer->next;
+        link_timer(timer);
+        timer = next;
+    }
+}
+
+wheel_timer* timerwheel_timer_create(void (*expired)(int id, void* arg), const int id) {
+    wheel_timer* timer = calloc(1, sizeof(wheel_timer));
+    timer->expired = expired;
+    timer->id = id;
+    return timer;
+}
+
+void timerwheel_arm(wheel_timer* timer, const unsigned ms) {
+    const unsigned long long now = now_ms();
+    if (armed == 0) {
+        current = now / TIMERWHEEL_TICK_MS; /* Nothing to catch up on */
+    }
+    unsigned long long expires = (now + ms + TIMERWHEEL_TICK_MS - 1) / TIMERWHEEL_TICK_MS;
+    if (expires <= current) {
+        expires = current + 1;
+    }
+    if (timer->slot != NULL && timer->expires == expires) {
+        return; /* Pushed back by less than a tick, which happens on nearly every event */
+    }
+    timerwheel_cancel(timer);
+    timer->expires = expires;
+    link_timer(timer);
+    ++armed;
+}
+
+void timerwheel_cancel(wheel_timer* timer) {
+    if (timer->slot != NULL) {
+        unlink_timer(timer);
+        --armed;
+    }
+}
+
+void timerwheel_timer_destroy(wheel_timer* timer) {
+    if (timer == NULL) {
+        return;
+    }
+    timerwheel_cancel(timer);
+    free(timer);
+}
+
+int timerwheel_next_timeout(void) {
+    if (armed == 0) {
+        return -1;
+    }
+    const unsigned long long now = now_ms();
+    const unsigned long long next_tick = (current + 1) * TIMERWHEEL_TICK_MS;
+    return next_tick > now ? (int)(next_tick - now) : 0;
+}
+
+void timerwheel_expire(void* arg) {
+    const unsigned long long target = now_ms() / TIMERWHEEL_TICK_MS;
+    while (armed > 0 && current < target) {
+        ++current;
+        for (int level = 1;
+             level < TIMERWHEEL_LEVELS && (current & ((1ULL << (TIMERWHEEL_SLOT_BITS * level)) - 1)) == 0; ++level) {
+            cascade(level, (current >> (TIMERWHEEL_SLOT_BITS * level)) & SLOT_MASK);
+        }
+        /* Taken off one at a time, a callback may destroy the timers after its own */
+        wheel_timer** slot = &slots[0][current & SLOT_MASK];
+        while (*slot != NULL) {
+            wheel_timer* timer = *slot;
+            timerwheel_cancel(timer);
+            timer->expired(timer->id, arg);
+        }
+    }
+}
@@ -0,0 +1,49 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+
+/**
+ * A hierarchical timer wheel for the deadlines of client connections. Arming, re-arming and cancelling a timer are
+ * O(1), so the epoll loop can push a deadline back on every event, and expired timers are found without looking at
+ * the ones that are not due yet.
+ *
+ * Timers have a resolution of TIMERWHEEL_TICK_MS. The wheel has TIMERWHEEL_LEVELS levels of TIMERWHEEL_SLOTS slots,
+ * each level counting in whole turns of the one below; a timer moves down a level whenever the level below comes
+ * around to it. Only to be used from the epoll thread.
+ */
+#define TIMERWHEEL_TICK_MS 100
+#define TIMERWHEEL_LEVELS 4
+#define TIMERWHEEL_SLOT_BITS 6
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_SLOT_BITS)
+
+typedef struct wheel_timer wheel_timer;
+
+/**
+ * @param expired called with `id` and the argument of timerwheel_expire when the timer goes off
+ * @return a timer that is not armed
+ */
+wheel_timer* timerwheel_timer_create(void (*expired)(int id, void* arg), int id);
+
+/**
+ * @brief Makes `timer` go off `ms` milliseconds from now, replacing when it was going to go off before.
+ */
+void timerwheel_arm(wheel_timer* timer, unsigned ms);
+
+void timerwheel_cancel(wheel_timer* timer);
+
+/**
+ * @brief Cancels and frees `timer`. NULL is ignored.
+ */
+void timerwheel_timer_destroy(wheel_timer* timer);
+
+/**
+ * @return milliseconds until timerwheel_expire has work to do, as a timeout for epoll_wait; -1 if no timer is armed
+ */
+int timerwheel_next_timeout(void);
+
+/**
+ * @brief Calls back every timer that went off, which is disarmed first. Callbacks may arm, cancel or destroy timers.
+ */
+void timerwheel_expire(void* arg);
@@ -0,0 +1,198 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+struct uring_file {
+    int fd; // Our own duplicate, so the caller can close theirs while writes are in flight
+    int owner;
+    size_t in_flight;
+    bool failed;
+    bool released;
+};
+
+typedef struct {
+    uring_file* file;
+    size_t size;
+    char data[];
+} pending_write;
+
+static int ring_fd = -1;
+static int event_fd = -1;
+
+/* Submission ring */
+static unsigned* sq_tail;
+static unsigned* sq_mask;
+static unsigned* sq_array;
+static struct io_uring_sqe* sqes;
+
+/* Completion ring */
+static unsigned* cq_head;
+static unsigned* cq_tail;
+static unsigned* cq_mask;
+static struct io_uring_cqe* cqes;
+
+static unsigned in_flight; // Writes submitted and not completed yet, at most URING_ENTRIES
+
+static int io_uring_setup(const unsigned entries, struct io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(const int fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(const int fd, const unsigned opcode, void* arg, const unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool uring_init(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = io_uring_setup(URING_ENTRIES, &params);
+    if (ring_fd == -1) {
+        return false;
+    }
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+    }
+    char* sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    char* cq = sq;
+    if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    }
+    sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED || event_fd == -1 ||
+        io_uring_register(ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) == -1) {
+        /* The process is about to fall back to plain writes, the mappings are not worth cleaning up */
+        close(ring_fd);
+        ring_fd = -1;
+        if (event_fd != -1) {
+            close(event_fd);
+            event_fd = -1;
+        }
+        return false;
+    }
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+int uring_event_fd(void) {
+    return event_fd;
+}
+
+static void file_unref(uring_file* file) {
+    if (file->released && file->in_flight == 0) {
+        close(file->fd);
+        free(file);
+    }
+}
+
+void uring_handle_completions(void (*completed)(int owner, void* arg), void* arg) {
+    if (ring_fd == -1) {
+        return;
+    }
+    uint64_t count;
+    read(event_fd, &count, sizeof(count));
+    unsigned head = *cq_head;
+    const unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        const struct io_uring_cqe* cqe = &cqes[head & *cq_mask];
+        pending_write* write = (pending_write*)(uintptr_t)cqe->user_data;
+        if (cqe->res < 0 || (size_t)cqe->res != write->size) {
+            write->file->failed = true;
+        }
+        --write->file->in_flight;
+        --in_flight;
+        if (!write->file->released) {
+            completed(write->file->owner, arg);
+        }
+        file_unref(write->file);
+        free(write);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+uring_file* uring_file_create(const int fd, const int owner) {
+    if (ring_fd == -1) {
+        return NULL;
+    }
+    uring_file* file = calloc(1, sizeof(uring_file));
+    file->fd = dup(fd);
+    file->owner = owner;
+    return file;
+}
+
+bool uring_write(uring_file* file, const void* data, const size_t size, const off_t offset) {
+    /* Never more in flight than the completion ring holds, so no completion is dropped */
+    if (in_flight == URING_ENTRIES) {
+        return false;
+    }
+    pending_write* write = malloc(sizeof(pending_write) + size);
+    write->file = file;
+    write->size = size;
+    memcpy(write->data, data, size);
+
+    const unsigned tail = *sq_tail;
+    const unsigned index = tail & *sq_mask;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = file->fd;
+    sqe->addr = (uintptr_t)write->data;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uintptr_t)write;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (io_uring_enter(ring_fd, 1, 0, 0) != 1) {
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        free(write);
+        return false;
+    }
+    ++file->in_flight;
+    ++in_flight;
+    return true;
+}
+
+bool uring_busy(const uring_file* file) {
+    return file->in_flight >= URING_MAX_IN_FLIGHT;
+}
+
+bool uring_done(const uring_file* file) {
+    return file->in_flight == 0;
+}
+
+bool uring_failed(const uring_file* file) {
+    return file->failed;
+}
+
+void uring_file_release(uring_file* file) {
+    if (file == NULL) {
+        return;
+    }
+    file->released = true;
+    file_unref(file);
+}
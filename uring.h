@@ -0,0 +1,72 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Writes uploads to disk through io_uring, so a slow disk does not stall the epoll loop: PUT hands each chunk it
+ * received to the kernel and goes on serving other clients while the write completes. Completions are signalled on
+ * an eventfd that the epoll loop watches, which calls uring_handle_completions. That names the sockets whose writes
+ * completed, so an upload waiting for the disk can stay out of epoll meanwhile.
+ *
+ * Talks to the kernel with the raw system calls, no liburing needed. Only to be used from the epoll thread.
+ */
+#define URING_ENTRIES 256
+#define URING_CHUNK_SIZE (64 * 1024) // Largest write handed to the kernel at once
+#define URING_MAX_IN_FLIGHT 8 // Writes of one file queued at most, the upload waits for the disk beyond that
+
+/**
+ * @brief Sets up the ring.
+ * @return false if the kernel does not support io_uring, writes then have to be done synchronously
+ */
+bool uring_init(void);
+
+/**
+ * @return the eventfd that becomes readable when writes completed, -1 if uring_init failed or was not called
+ */
+int uring_event_fd(void);
+
+/**
+ * @brief Handles every completed write, calling `completed` with the owner of its file unless that was released.
+ * Call when uring_event_fd is readable.
+ */
+void uring_handle_completions(void (*completed)(int owner, void* arg), void* arg);
+
+typedef struct uring_file uring_file;
+
+/**
+ * @brief Starts writing to `fd`, which the caller may close while writes are in flight.
+ * @param owner socket of the client uploading the file, see uring_handle_completions
+ * @return NULL if io_uring is not in use
+ */
+uring_file* uring_file_create(int fd, int owner);
+
+/**
+ * @brief Queues writing `size` bytes of `data` (which are copied) at `offset`.
+ * @return false if the write could not be queued, the caller then has to do it itself
+ */
+bool uring_write(uring_file* file, const void* data, size_t size, off_t offset);
+
+/**
+ * @return whether URING_MAX_IN_FLIGHT writes are waiting for the disk
+ */
+bool uring_busy(const uring_file* file);
+
+/**
+ * @return whether every queued write completed
+ */
+bool uring_done(const uring_file* file);
+
+/**
+ * @return whether a completed write failed or was short
+ */
+bool uring_failed(const uring_file* file);
+
+/**
+ * @brief Gives up the file, which is freed once its writes completed.
+ */
+void uring_file_release(uring_file* file);
@@ -0,0 +1,143 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "catalog.h"
+#include "catalog_sync.h"
+#include "common.h"
+#include "fdcache.h"
+#include "hotcache.h"
+#include "layout.h"
+#include "pack.h"
+#include "scan.h"
+#include "watch.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)
+
+static int watch_fd = -1;
+static int dir_fd = -1;
+static char* watch_dir;
+static size_t rescan_threads;
+static pthread_mutex_t rescan_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool rescanning = false;
+
+static void* rescan_worker(void* arg) {
+    (void)arg;
+    scan_reconcile(watch_dir, rescan_threads);
+    pthread_mutex_lock(&rescan_lock);
+    rescanning = false;
+    pthread_mutex_unlock(&rescan_lock);
+    return NULL;
+}
+
+/**
+ * @brief Rescans the directory on a background thread, after the kernel's event queue overflowed.
+ */
+static void start_rescan(void) {
+    pthread_mutex_lock(&rescan_lock);
+    const bool running = rescanning;
+    rescanning = true;
+    pthread_mutex_unlock(&rescan_lock);
+    if (running) {
+        return;
+    }
+    LOG("watch: missed changes to %s, rescanning it", watch_dir);
+
+    if (!spawn_detached(rescan_worker, NULL)) {
+        pthread_mutex_lock(&rescan_lock);
+        rescanning = false;
+        pthread_mutex_unlock(&rescan_lock);
+    }
+}
+
+int watch_start(const char* dir, const size_t scan_threads) {
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd == -1) {
+        perror("inotify_init1() failed");
+        return -1;
+    }
+    if (inotify_add_watch(watch_fd, dir, WATCH_EVENTS | IN_ONLYDIR) == -1) {
+        perror("inotify_add_watch() failed");
+        close(watch_fd);
+        watch_fd = -1;
+        return -1;
+    }
+    dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    watch_dir = realpath(dir, NULL);
+    rescan_threads = scan_threads;
+    return watch_fd;
+}
+
+/**
+ * @brief Adds `name` if it is a regular file in the directory, unless we already know about it.
+ * With the hashed layout, the file is moved into its subdirectory first.
+ * Our own PUTs add their file before writing it, so they are not reported to the main server twice.
+ */
+static void file_appeared(const char* name) {
+    struct stat s;
+    char path[LAYOUT_PATH_MAX];
+    catalog_lock();
+    hotcache_invalidate(name); /* Possibly rewritten in place */
+    fdcache_invalidate(name);
+    layout_ingest(dir_fd, name);
+    if (!catalog_has_local(name) && fstatat(dir_fd, layout_path(name, path), &s, 0) == 0 && S_ISREG(s.st_mode)) {
+        catalog_add_local(name);
+        catalog_sync_record(SYNC_ADD, name);
+    }
+    catalog_unlock();
+}
+
+/**
+ * @brief Removes `name`, unless it was already removed by our own DELETE or the rebalancer, or is back already
+ * (which includes a small PUT moving it into a pack).
+ * With the hashed layout only the top of the share is watched, so this only sees files we moved into place.
+ */
+static void file_disappeared(const char* name) {
+    struct stat s;
+    char path[LAYOUT_PATH_MAX];
+    catalog_lock();
+    if (!pack_contains(name) && fstatat(dir_fd, layout_path(name, path), &s, 0) == -1 &&
+        catalog_remove_local(name)) {
+        hotcache_invalidate(name);
+        fdcache_invalidate(name);
+        catalog_sync_record(SYNC_REMOVE, name);
+    }
+    catalog_unlock();
+}
+
+void watch_handle_events(void) {
+    /* Aligned like the kernel expects, see inotify(7) */
+    char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(watch_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* pos = buffer; pos < buffer + len;) {
+            const struct inotify_event* event = (const struct inotify_event*)pos;
+            pos += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                start_rescan();
+                continue;
+            }
+            if (event->len == 0 || event->mask & IN_ISDIR) {
+                continue;
+            }
+            if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                file_appeared(event->name);
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                file_disappeared(event->name);
+            }
+        }
+    }
+    if (len == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("reading inotify events failed");
+    }
+}
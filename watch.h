@@ -0,0 +1,26 @@
+/**
+ * nonstop_networking
+ * CS 341 - Spring 2025
+ */
+#pragma once
+#include <stddef.h>
+
+/**
+ * Keeps the catalog's local files in line with Pi-Share when other processes add or remove files there.
+ * A file counts as added once it is closed after writing or renamed into the directory, so writers that want it to
+ * appear all at once should write it elsewhere (or under a temporary name) and rename it in.
+ * With the hashed layout, new files have to be put directly into Pi-Share and are moved into place from there; files
+ * removed from the subdirectories by other processes are only noticed when a GET fails or on the next restart.
+ */
+
+/**
+ * @brief Starts watching the directory `dir` with inotify.
+ * @param scan_threads threads used to rescan `dir` if the kernel drops events, see scan_local_files
+ * @return a non-blocking file descriptor to add to the epoll set, or -1 if the directory can not be watched
+ */
+int watch_start(const char* dir, size_t scan_threads);
+
+/**
+ * @brief Applies every pending change to the catalog. Call when the watch descriptor is readable.
+ */
+void watch_handle_events(void);